@@ -0,0 +1,129 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <benchmark_utils.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef __unix__
+#include <sys/resource.h>
+#include <unistd.h>
+#endif /* __unix__ */
+
+namespace {
+
+std::atomic<size_t> allocation_count(0);
+std::atomic<size_t> allocation_bytes(0);
+
+} /* anonymous namespace */
+
+void*
+operator new(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void
+operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace benchmark {
+
+Allocation_stats
+Get_allocation_stats()
+{
+    Allocation_stats stats;
+    stats.count = allocation_count.load(std::memory_order_relaxed);
+    stats.bytes = allocation_bytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+size_t
+Get_peak_memory_kb()
+{
+#ifdef __unix__
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // Linux reports kilobytes.
+        return usage.ru_maxrss;
+    }
+#endif /* __unix__ */
+    return 0;
+}
+
+size_t
+Get_resident_memory_kb()
+{
+#ifdef __unix__
+    size_t pages = 0;
+    // Second field of statm is the resident set size in pages.
+    auto file = fopen("/proc/self/statm", "r");
+    if (file) {
+        if (fscanf(file, "%*s %zu", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(file);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return 0;
+#endif /* __unix__ */
+}
+
+std::chrono::nanoseconds
+Get_process_cpu_time()
+{
+#ifdef __unix__
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+            std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+    }
+#endif /* __unix__ */
+    return std::chrono::nanoseconds::zero();
+}
+
+Measurement::Measurement():
+    start_time(std::chrono::steady_clock::now()),
+    start_allocations(Get_allocation_stats())
+{
+}
+
+void
+Measurement::Report(const std::string& name, size_t elements, const std::string& unit)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_time).count();
+    auto allocations = Get_allocation_stats();
+    auto count = allocations.count - start_allocations.count;
+    auto bytes = allocations.bytes - start_allocations.bytes;
+    if (!elements) {
+        elements = 1;
+    }
+    printf("%-32s %9zu %-8s %12.1f ns/%s %8.2f allocs/%s %10.1f bytes/%s %10zu KB peak\n",
+        name.c_str(),
+        elements, unit.c_str(),
+        static_cast<double>(elapsed) / elements, unit.c_str(),
+        static_cast<double>(count) / elements, unit.c_str(),
+        static_cast<double>(bytes) / elements, unit.c_str(),
+        Get_peak_memory_kb());
+}
+
+} /* namespace benchmark */
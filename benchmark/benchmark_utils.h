@@ -0,0 +1,59 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file benchmark_utils.h
+ *
+ * Measurement helpers shared by PX4 VSM benchmarks.
+ */
+#ifndef _BENCHMARK_UTILS_H_
+#define _BENCHMARK_UTILS_H_
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+namespace benchmark {
+
+/** Heap allocation counters. Updated by the replaced global operator new. */
+struct Allocation_stats {
+    size_t count = 0;
+    size_t bytes = 0;
+};
+
+/** Get allocations made so far by the process. */
+Allocation_stats
+Get_allocation_stats();
+
+/** Peak resident memory of the process in kilobytes, 0 if unknown. */
+size_t
+Get_peak_memory_kb();
+
+/** Current resident memory of the process in kilobytes, 0 if unknown. */
+size_t
+Get_resident_memory_kb();
+
+/** User and system CPU time consumed by all threads of the process. */
+std::chrono::nanoseconds
+Get_process_cpu_time();
+
+/** Measures wall time and allocations of a code section. */
+class Measurement {
+public:
+    /** Start measuring. */
+    Measurement();
+
+    /** Stop measuring and print results normalized by the number of
+     * processed elements. */
+    void
+    Report(const std::string& name, size_t elements, const std::string& unit);
+
+private:
+    std::chrono::steady_clock::time_point start_time;
+    Allocation_stats start_allocations;
+};
+
+} /* namespace benchmark */
+
+#endif /* _BENCHMARK_UTILS_H_ */
@@ -0,0 +1,296 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * Runs the real Px4_vehicle_manager against N simulated PX4 vehicles on
+ * loopback UDP (connection.udp_in.1.local_port of the configuration) and
+ * reports for each N: VSM CPU per vehicle, handler latency percentiles of
+ * SYSTEM_TIME probes sent by the simulator, resident memory per vehicle
+ * and the share of delivered probes. The first N delivering less than
+ * DELIVERY_THRESHOLD of probes is reported as the telemetry drop point.
+ *
+ * Usage: scale_benchmark [--config <vsm.conf>] [--duration <s>]
+ *        [--telemetry-rate <Hz>] [--probe-rate <Hz>] [vehicles ...]
+ */
+
+#include <ugcs/vsm/vsm.h>
+#include <px4_vehicle_manager.h>
+#include <simulation.h>
+#include <benchmark_utils.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+
+DEFINE_DEFAULT_VSM_NAME;
+
+using namespace ugcs::vsm;
+
+namespace {
+
+/** Number of vehicles measured by default. */
+const std::vector<size_t> DEFAULT_VEHICLE_COUNTS = {1, 10, 50, 100, 200, 500};
+
+/** Vehicles are expected to connect and disconnect within this time. */
+const std::chrono::seconds CONNECT_TIMEOUT(60);
+
+/** Telemetry is considered dropped below this share of delivered probes. */
+const double DELIVERY_THRESHOLD = 0.99;
+
+/** Simulated vehicle uids start here, so they do not clash with real ones. */
+const uint64_t UID_BASE = 0x5343414c45000000;
+
+/** Probe results shared by all vehicles. */
+struct Probes {
+    std::mutex mutex;
+    bool measuring = false;
+    size_t received = 0;
+    std::vector<double> latencies_us;
+};
+
+Probes probes;
+
+std::atomic<size_t> vehicles_enabled(0);
+
+/** PX4 vehicle which also handles simulator probes. */
+class Benchmark_vehicle: public Px4_vehicle {
+    DEFINE_COMMON_CLASS(Benchmark_vehicle, Px4_vehicle)
+
+public:
+    template<typename... Args>
+    Benchmark_vehicle(Args &&... args):
+        Px4_vehicle(std::forward<Args>(args)...)
+    {}
+
+    virtual void
+    On_enable() override
+    {
+        Px4_vehicle::On_enable();
+        common_handlers.Register_mavlink_handler<mavlink::MESSAGE_ID::SYSTEM_TIME>(
+            &Benchmark_vehicle::On_probe,
+            this);
+        vehicles_enabled++;
+    }
+
+    virtual void
+    On_disable() override
+    {
+        vehicles_enabled--;
+        Px4_vehicle::On_disable();
+    }
+
+private:
+    void
+    On_probe(mavlink::Message<mavlink::MESSAGE_ID::SYSTEM_TIME>::Ptr message)
+    {
+        auto now = px4_sim::Px4_endpoint::Get_probe_time(px4_sim::Px4_endpoint::Clock::now());
+        auto sent = message->payload->time_unix_usec.Get();
+        std::unique_lock<std::mutex> lock(probes.mutex);
+        if (probes.measuring) {
+            probes.received++;
+            probes.latencies_us.push_back(static_cast<double>(now - sent));
+        }
+    }
+};
+
+class Benchmark_manager: public Px4_vehicle_manager {
+    DEFINE_COMMON_CLASS(Benchmark_manager, Px4_vehicle_manager)
+
+private:
+    virtual Mavlink_vehicle::Ptr
+    Create_mavlink_vehicle(
+            Mavlink_demuxer::System_id system_id,
+            Mavlink_demuxer::Component_id component_id,
+            mavlink::MAV_TYPE type,
+            Mavlink_stream::Ptr stream,
+            Socket_address::Ptr,
+            Optional<std::string> mission_dump_path,
+            const std::string& serial_number,
+            const std::string& model_name,
+            Request_processor::Ptr proc,
+            Request_completion_context::Ptr comp) override
+    {
+        auto vehicle = Benchmark_vehicle::Create(
+                system_id,
+                component_id,
+                type,
+                stream,
+                mission_dump_path,
+                serial_number,
+                model_name,
+                proc,
+                comp);
+        vehicle->Set_timer_wheel(Get_timer_wheel(comp));
+        vehicle->Set_mission_dump_writer(Get_mission_dump_writer());
+        return vehicle;
+    }
+};
+
+struct Options {
+    std::chrono::seconds duration {10};
+    float telemetry_rate = 5;
+    float probe_rate = 10;
+    std::vector<size_t> counts;
+};
+
+bool
+Wait_for_vehicles(size_t count)
+{
+    auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+    while (vehicles_enabled != count) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return true;
+}
+
+double
+Percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+/** Run N vehicles, return delivered share of probes. */
+double
+Run(const sockaddr_in& vsm_address, const Options& options, size_t count)
+{
+    auto memory_start = benchmark::Get_resident_memory_kb();
+
+    px4_sim::Simulation sim;
+    for (size_t i = 0; i < count; i++) {
+        px4_sim::Endpoint_config config;
+        // Each endpoint has own UDP port, so system ids may repeat.
+        config.system_id = 1 + i % 250;
+        config.uid = UID_BASE + i;
+        config.telemetry_rate = options.telemetry_rate;
+        config.probe_rate = options.probe_rate;
+        config.latitude += 0.001 * i;
+        sim.Add(std::unique_ptr<px4_sim::Px4_endpoint>(
+            new px4_sim::Px4_endpoint(config, vsm_address)));
+    }
+    sim.Start();
+    if (!Wait_for_vehicles(count)) {
+        std::cerr << "Only " << vehicles_enabled << " of " << count
+                  << " vehicles connected." << std::endl;
+    }
+    auto memory_kb = benchmark::Get_resident_memory_kb() - memory_start;
+
+    auto sim_stats = sim.Get_stats();
+    auto sim_cpu = sim.Get_cpu_time();
+    auto cpu = benchmark::Get_process_cpu_time();
+    {
+        std::unique_lock<std::mutex> lock(probes.mutex);
+        probes.measuring = true;
+        probes.received = 0;
+        probes.latencies_us.clear();
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(options.duration);
+    std::vector<double> latencies;
+    size_t received;
+    {
+        std::unique_lock<std::mutex> lock(probes.mutex);
+        probes.measuring = false;
+        received = probes.received;
+        latencies.swap(probes.latencies_us);
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto vsm_cpu = (benchmark::Get_process_cpu_time() - cpu) - (sim.Get_cpu_time() - sim_cpu);
+    auto sent = sim.Get_stats().probes_sent - sim_stats.probes_sent;
+
+    sim.Stop();
+    sim.Clear();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto delivered = sent ? static_cast<double>(received) / sent : 0;
+    printf("%5zu vehicles %8.3f %%cpu/vehicle  latency p50 %8.1f p90 %8.1f p99 %8.1f us"
+           "  %8.1f KB/vehicle  probes %zu/%zu (%.2f%%)\n",
+        count,
+        std::chrono::duration<double>(vsm_cpu).count() / elapsed / count * 100,
+        Percentile(latencies, 0.5), Percentile(latencies, 0.9), Percentile(latencies, 0.99),
+        static_cast<double>(memory_kb) / count,
+        received, sent, delivered * 100);
+    fflush(stdout);
+
+    // Vehicles disconnect by heartbeat timeout.
+    if (!Wait_for_vehicles(0)) {
+        std::cerr << vehicles_enabled << " vehicles did not disconnect." << std::endl;
+    }
+    return delivered;
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+    ugcs::vsm::Initialize(argc, argv, "vsm-px4.conf");
+
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--config") {
+            i++;
+            continue;
+        }
+        if (i + 1 < argc && arg == "--duration") {
+            options.duration = std::chrono::seconds(std::strtoul(argv[++i], nullptr, 10));
+            continue;
+        }
+        if (i + 1 < argc && arg == "--telemetry-rate") {
+            options.telemetry_rate = std::strtof(argv[++i], nullptr);
+            continue;
+        }
+        if (i + 1 < argc && arg == "--probe-rate") {
+            options.probe_rate = std::strtof(argv[++i], nullptr);
+            continue;
+        }
+        auto count = std::strtoul(argv[i], nullptr, 10);
+        if (count) {
+            options.counts.push_back(count);
+        }
+    }
+    if (options.counts.empty()) {
+        options.counts = DEFAULT_VEHICLE_COUNTS;
+    }
+
+    auto props = Properties::Get_instance();
+    if (!props->Exists("connection.udp_in.1.local_port")) {
+        std::cerr << "connection.udp_in.1.local_port is not configured." << std::endl;
+        ugcs::vsm::Terminate();
+        return 1;
+    }
+    sockaddr_in vsm_address = {};
+    vsm_address.sin_family = AF_INET;
+    vsm_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    vsm_address.sin_port = htons(props->Get_int("connection.udp_in.1.local_port"));
+
+    auto manager = Benchmark_manager::Create();
+    manager->Enable();
+
+    Optional<size_t> drop_point;
+    for (auto count : options.counts) {
+        auto delivered = Run(vsm_address, options, count);
+        if (!drop_point && delivered < DELIVERY_THRESHOLD) {
+            drop_point = count;
+        }
+    }
+    if (drop_point) {
+        std::cout << "Telemetry drop point: " << *drop_point << " vehicles" << std::endl;
+    } else {
+        std::cout << "No telemetry drops up to " << options.counts.back() << " vehicles" << std::endl;
+    }
+
+    manager->Disable();
+    manager = nullptr;
+    ugcs::vsm::Terminate();
+    return 0;
+}
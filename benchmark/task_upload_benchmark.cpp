@@ -0,0 +1,164 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * Measures how route compilation (Task_upload::Filter_actions,
+ * Prepare_task and native route generation) scales with the route size.
+ * Synthetic survey routes are processed offline by the command processor
+ * vehicle, no real vehicle is needed.
+ *
+ * Usage: task_upload_benchmark [--config <vsm.conf>] [actions ...]
+ */
+
+#include <ugcs/vsm/vsm.h>
+#include <px4_vehicle.h>
+#include <benchmark_utils.h>
+#include <cstdlib>
+#include <iostream>
+
+DEFINE_DEFAULT_VSM_NAME;
+
+using namespace ugcs::vsm;
+
+namespace {
+
+/** Number of actions in routes measured by default. */
+const std::vector<size_t> DEFAULT_ROUTE_SIZES = {1000, 10000, 100000};
+
+/** Build survey route of given number of actions. Route is a lawnmower
+ * pattern with camera series, POI/heading changes and speed changes
+ * mixed in the way survey tools generate them. */
+Vehicle_task_request::Handle
+Build_route(Px4_vehicle::Ptr vehicle, Request_completion_context::Ptr ctx, size_t action_count)
+{
+    auto request = Vehicle_task_request::Create(
+        vehicle,
+        Vehicle_request::Completion_handler(),
+        ctx,
+        proto::Device_command());
+    Vehicle_task_request::Handle handle(request);
+
+    // Survey area around 56.95N 24.1E, lines 20 m apart.
+    const double lat0 = 56.95 * M_PI / 180;
+    const double lon0 = 24.1 * M_PI / 180;
+    const double line_step = 20.0 / 6378137.0;
+    const double wp_step = 10.0 / 6378137.0 / cos(lat0);
+    const size_t wps_per_line = 50;
+
+    auto& actions = handle->actions;
+    actions.reserve(action_count);
+    size_t wp = 0;
+    uint32_t command_id = 1;
+    while (actions.size() < action_count) {
+        size_t line = wp / wps_per_line;
+        size_t pos = wp % wps_per_line;
+        if (line % 2) {
+            pos = wps_per_line - 1 - pos;
+        }
+        Geodetic_tuple position(
+            lat0 + line * line_step,
+            lon0 + pos * wp_step,
+            50 + (wp % 7));
+        Action::Ptr action;
+        if (wp % 500 == 0) {
+            action = Change_speed_action::Create(5 + (wp / 500) % 3, 0);
+        } else if (wp % wps_per_line == 0) {
+            action = Camera_series_by_distance_action::Create(
+                15,
+                Optional<int>(),
+                std::chrono::milliseconds(0));
+        } else if (wp % 200 == 1) {
+            action = Poi_action::Create(
+                Geodetic_tuple(lat0, lon0, 0),
+                (wp / 200) % 2 == 0);
+        } else if (wp % 300 == 2) {
+            action = Heading_action::Create(((wp / 300) % 4) * M_PI / 2);
+        } else {
+            action = Move_action::Create(
+                Wgs84_position(position), 0, 1, 0, NAN, 0);
+        }
+        action->command_id = command_id++;
+        actions.push_back(action);
+        wp++;
+    }
+    return handle;
+}
+
+void
+Run(Px4_vehicle::Ptr vehicle, Request_completion_context::Ptr ctx, size_t action_count)
+{
+    auto& task_upload = vehicle->task_upload;
+
+    // Route construction itself is not measured.
+    auto request = Build_route(vehicle, ctx, action_count);
+
+    {
+        benchmark::Measurement m;
+        task_upload.request = request;
+        task_upload.Filter_actions();
+        m.Report("filter_actions", action_count, "action");
+    }
+    {
+        benchmark::Measurement m;
+        task_upload.Prepare_task();
+        m.Report("prepare_task", action_count, "action");
+    }
+    auto items = task_upload.prepared_actions.size();
+    {
+        benchmark::Measurement m;
+        auto wpl = Generate_wpl(task_upload.prepared_actions, false);
+        m.Report("generate_wpl", items, "item");
+        if (wpl.empty()) {
+            std::cerr << "Empty native route generated." << std::endl;
+        }
+    }
+
+    // Complete path as used for native route requests.
+    request = Build_route(vehicle, ctx, action_count);
+    request->return_native_route = true;
+    {
+        benchmark::Measurement m;
+        task_upload.Enable(request);
+        m.Report("native_route_total", action_count, "action");
+    }
+    std::cout << action_count << " actions compiled into " << items << " mission items." << std::endl;
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+    ugcs::vsm::Initialize(argc, argv, "vsm-px4.conf");
+
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--config") {
+            i++;
+            continue;
+        }
+        auto size = std::strtoul(argv[i], nullptr, 10);
+        if (size) {
+            sizes.push_back(size);
+        }
+    }
+    if (sizes.empty()) {
+        sizes = DEFAULT_ROUTE_SIZES;
+    }
+
+    auto ctx = Request_completion_context::Create("Benchmark completion");
+    ctx->Enable();
+    // Command processor vehicle does not need a connection.
+    auto vehicle = Px4_vehicle::Create(proto::VEHICLE_TYPE_MULTICOPTER);
+
+    for (auto size : sizes) {
+        Run(vehicle, ctx, size);
+    }
+
+    ctx->Disable();
+    vehicle = nullptr;
+    ugcs::vsm::Terminate();
+    return 0;
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * Compares retry timer churn of many vehicles on Timer_processor timers
+ * (cancel and Create_timer on every re-arm, like activities did) with the
+ * shared Timer_wheel. Also measures the wheel ticking cost with periodic
+ * joystick timers of all vehicles armed.
+ *
+ * Usage: timer_wheel_benchmark [--config <vsm.conf>] [vehicles ...]
+ */
+
+#include <ugcs/vsm/vsm.h>
+#include <timer_wheel.h>
+#include <benchmark_utils.h>
+#include <cstdlib>
+#include <iostream>
+
+DEFINE_DEFAULT_VSM_NAME;
+
+using namespace ugcs::vsm;
+
+namespace {
+
+/** Number of vehicles measured by default. */
+const std::vector<size_t> DEFAULT_VEHICLE_COUNTS = {100, 1000, 10000};
+
+/** Re-arms per vehicle, e.g. retries and STATUSTEXT timeout extensions. */
+const size_t REARMS_PER_VEHICLE = 100;
+
+/** Retry timeout, long enough for timers never to fire during the run. */
+const std::chrono::milliseconds RETRY_TIMEOUT(60000);
+
+/** Simulated joystick session length. */
+const std::chrono::seconds JOYSTICK_DURATION(10);
+
+const std::chrono::milliseconds JOYSTICK_PERIOD(200);
+
+const std::chrono::milliseconds TICK(10);
+
+bool
+Never_called()
+{
+    std::cerr << "Retry timer fired during the benchmark." << std::endl;
+    return false;
+}
+
+void
+Run_timer_processor(Request_completion_context::Ptr ctx, size_t vehicles)
+{
+    std::vector<Timer_processor::Timer::Ptr> timers(vehicles);
+    auto processor = Timer_processor::Get_instance();
+    benchmark::Measurement m;
+    for (size_t i = 0; i < REARMS_PER_VEHICLE; i++) {
+        for (auto& timer : timers) {
+            if (timer) {
+                timer->Cancel();
+            }
+            timer = processor->Create_timer(RETRY_TIMEOUT, Make_callback(Never_called), ctx);
+        }
+    }
+    for (auto& timer : timers) {
+        timer->Cancel();
+    }
+    m.Report("timer_processor_rearm", vehicles * REARMS_PER_VEHICLE, "rearm");
+}
+
+void
+Run_timer_wheel(size_t vehicles)
+{
+    Timer_wheel wheel(TICK);
+    std::vector<std::unique_ptr<Timer_wheel::Timer>> timers;
+    for (size_t i = 0; i < vehicles; i++) {
+        timers.emplace_back(new Timer_wheel::Timer(Never_called));
+    }
+    {
+        benchmark::Measurement m;
+        for (size_t i = 0; i < REARMS_PER_VEHICLE; i++) {
+            for (auto& timer : timers) {
+                wheel.Arm(*timer, RETRY_TIMEOUT);
+            }
+        }
+        for (auto& timer : timers) {
+            timer->Cancel();
+        }
+        m.Report("timer_wheel_rearm", vehicles * REARMS_PER_VEHICLE, "rearm");
+    }
+
+    // Joystick timers of all vehicles, the wheel is advanced in simulated
+    // time, so the run takes only the processing time.
+    size_t fired = 0;
+    for (auto& timer : timers) {
+        timer->Set_handler([&fired]() { fired++; return true; });
+        wheel.Arm(*timer, JOYSTICK_PERIOD);
+    }
+    auto now = Timer_wheel::Clock::now();
+    auto end = now + JOYSTICK_DURATION;
+    benchmark::Measurement m;
+    for (; now < end; now += TICK) {
+        wheel.Advance(now);
+    }
+    m.Report("timer_wheel_periodic", fired, "expiration");
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+    ugcs::vsm::Initialize(argc, argv, "vsm-px4.conf");
+
+    std::vector<size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--config") {
+            i++;
+            continue;
+        }
+        auto count = std::strtoul(argv[i], nullptr, 10);
+        if (count) {
+            counts.push_back(count);
+        }
+    }
+    if (counts.empty()) {
+        counts = DEFAULT_VEHICLE_COUNTS;
+    }
+
+    auto ctx = Request_completion_context::Create("Benchmark completion");
+    ctx->Enable();
+
+    for (auto count : counts) {
+        std::cout << count << " vehicles:" << std::endl;
+        Run_timer_processor(ctx, count);
+        Run_timer_wheel(count);
+    }
+
+    ctx->Disable();
+    ugcs::vsm::Terminate();
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file mission_dump_writer.h
+ */
+#ifndef _MISSION_DUMP_WRITER_H_
+#define _MISSION_DUMP_WRITER_H_
+
+#include <wpl_writer.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Writes mission dumps in a background thread, so slow storage does not
+ * stall vehicle processing. Dumps are queued up to a limit, dumps beyond
+ * it are dropped instead of blocking. Can be shared by many vehicles.
+ */
+class Mission_dump_writer {
+public:
+    typedef std::shared_ptr<Mission_dump_writer> Ptr;
+
+    /** Dump file formats, can be combined. */
+    enum Format {
+        /** QGC WPL 110 text, written to the given file name. */
+        FORMAT_TEXT = 1,
+        /** Compact binary, written to the file name with ".bin" suffix. */
+        FORMAT_BINARY = 2,
+    };
+
+    /** Binary dump starts with this, followed by uint32 item count and
+     * items of BINARY_ITEM_SIZE bytes, all little-endian. */
+    constexpr static char BINARY_MAGIC[8] = {'P', 'X', '4', 'M', 'D', 'M', 'P', '1'};
+
+    /** Item is seq, command (uint16), frame, current, autocontinue, one
+     * reserved byte, then param1..4, x, y, z (float). */
+    constexpr static size_t BINARY_ITEM_SIZE = 36;
+
+    /** Default limit of queued dumps. */
+    constexpr static size_t QUEUE_MAX = 4;
+
+    explicit Mission_dump_writer(size_t queue_max = QUEUE_MAX);
+
+    /** Writes all queued dumps and stops the thread. */
+    ~Mission_dump_writer();
+
+    Mission_dump_writer(const Mission_dump_writer&) = delete;
+
+    Mission_dump_writer&
+    operator=(const Mission_dump_writer&) = delete;
+
+    /** Queue mission for writing. Thread safe.
+     * @param formats Combination of Format flags.
+     * @return false if the queue is full and the dump is dropped.
+     */
+    bool
+    Write(std::string file_name, std::vector<Wpl_item> items, int formats);
+
+    /** Number of dumps dropped due to full queue. */
+    size_t
+    Get_dropped() const
+    {
+        return dropped;
+    }
+
+    /** Number of dump files which could not be written. */
+    size_t
+    Get_failed() const
+    {
+        return failed;
+    }
+
+private:
+    struct Job {
+        std::string file_name;
+        std::vector<Wpl_item> items;
+        int formats;
+    };
+
+    void
+    Run();
+
+    void
+    Write_job(const Job& job);
+
+    /** Write whole buffer to a new file, returns false on failure. */
+    bool
+    Write_file(const std::string& file_name, const std::string& data);
+
+    const size_t queue_max;
+
+    std::mutex mutex;
+
+    std::condition_variable cv;
+
+    std::deque<Job> queue;
+
+    bool stop = false;
+
+    std::atomic<size_t> dropped {0};
+
+    std::atomic<size_t> failed {0};
+
+    /** Formatting buffer reused by the writer thread. */
+    std::string buffer;
+
+    /** Started last, so all members are ready for the thread. */
+    std::thread thread;
+};
+
+#endif /* _MISSION_DUMP_WRITER_H_ */
@@ -0,0 +1,57 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file path_simplifier.h
+ */
+#ifndef _PATH_SIMPLIFIER_H_
+#define _PATH_SIMPLIFIER_H_
+
+#include <cstddef>
+#include <vector>
+
+/** Douglas-Peucker simplification of a 3D polyline. Removes points while
+ * the simplified path stays within the tolerance of every removed point.
+ * Anchor points split the path and are always kept, as are the first and
+ * the last points.
+ */
+class Path_simplifier {
+public:
+    /** @param tolerance Maximum distance of a removed point from the
+     * simplified path, in the units of the coordinates. */
+    explicit Path_simplifier(double tolerance);
+
+    /** Add next point of the path, in Cartesian coordinates. */
+    void
+    Add_point(double x, double y, double z, bool anchor);
+
+    /** Simplify the added path.
+     * @return Flag for each added point, true if the point is kept.
+     */
+    std::vector<bool>
+    Simplify() const;
+
+private:
+    struct Point {
+        double x;
+        double y;
+        double z;
+    };
+
+    /** Distance from point p to segment a-b. */
+    static double
+    Get_distance(const Point& p, const Point& a, const Point& b);
+
+    /** Simplify points first..last, both are kept. */
+    void
+    Simplify(size_t first, size_t last, std::vector<bool>& keep) const;
+
+    const double tolerance;
+
+    std::vector<Point> points;
+
+    std::vector<size_t> anchors;
+};
+
+#endif /* _PATH_SIMPLIFIER_H_ */
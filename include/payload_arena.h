@@ -0,0 +1,172 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file payload_arena.h
+ */
+#ifndef _PAYLOAD_ARENA_H_
+#define _PAYLOAD_ARENA_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/** Arena for MAVLink payloads created during one operation, like a mission
+ * upload or a command chain. Payloads are placed in large chunks instead of
+ * a separate heap allocation each, freeing a single payload is a no-op.
+ *
+ * Payloads still own a reference to the arena memory, so payloads which
+ * outlive Release() (e.g. queued for sending) stay valid. The memory is
+ * returned to the heap when the arena is released and the last payload
+ * created from it is destroyed.
+ *
+ * Not thread safe, must be used from a single completion context.
+ */
+class Payload_arena {
+public:
+    /** Create payload in the arena. */
+    template<class Payload, typename... Args>
+    typename Payload::Ptr
+    Create(Args &&... args)
+    {
+        if (!state) {
+            state = std::make_shared<State>(next_chunk_size);
+            next_chunk_size = MIN_CHUNK_SIZE;
+        }
+        return std::allocate_shared<Payload>(
+            Allocator<Payload>(state),
+            std::forward<Args>(args)...);
+    }
+
+    /** Make sure at least given number of bytes fits in the arena without
+     * further heap allocations. */
+    void
+    Reserve(size_t bytes)
+    {
+        if (state) {
+            state->Reserve(bytes);
+        } else {
+            next_chunk_size = std::max(next_chunk_size, bytes);
+        }
+    }
+
+    /** Release the arena. Next Create() starts a new one. */
+    void
+    Release()
+    {
+        state = nullptr;
+        next_chunk_size = MIN_CHUNK_SIZE;
+    }
+
+private:
+    /** Size of the first chunk. */
+    constexpr static size_t MIN_CHUNK_SIZE = 4096;
+
+    /** Chunk size stops growing here. */
+    constexpr static size_t MAX_CHUNK_SIZE = 1024 * 1024;
+
+    /** Alignment of each allocation. */
+    constexpr static size_t ALIGNMENT = alignof(std::max_align_t);
+
+    /** Arena memory, owned by the arena and all payloads created in it. */
+    class State {
+    public:
+        explicit State(size_t chunk_size):
+            next_chunk_size(chunk_size) {}
+
+        void*
+        Allocate(size_t size)
+        {
+            size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+            if (size > left) {
+                Add_chunk(std::max(size, next_chunk_size));
+                // Grow geometrically, so the number of chunks is logarithmic.
+                if (next_chunk_size < MAX_CHUNK_SIZE) {
+                    next_chunk_size *= 2;
+                }
+            }
+            void* ptr = pos;
+            pos += size;
+            left -= size;
+            return ptr;
+        }
+
+        void
+        Reserve(size_t bytes)
+        {
+            if (bytes > left) {
+                Add_chunk(bytes);
+            }
+        }
+
+    private:
+        void
+        Add_chunk(size_t size)
+        {
+            // operator new[] memory is aligned for any fundamental type.
+            chunks.emplace_back(new char[size]);
+            pos = chunks.back().get();
+            left = size;
+        }
+
+        std::vector<std::unique_ptr<char[]>> chunks;
+        char* pos = nullptr;
+        size_t left = 0;
+        size_t next_chunk_size;
+    };
+
+    /** Allocator placing shared_ptr control block and payload in the arena. */
+    template<class T>
+    class Allocator {
+    public:
+        typedef T value_type;
+
+        explicit Allocator(std::shared_ptr<State> state):
+            state(std::move(state)) {}
+
+        template<class U>
+        Allocator(const Allocator<U>& other):
+            state(other.state) {}
+
+        T*
+        allocate(size_t n)
+        {
+            return static_cast<T*>(state->Allocate(n * sizeof(T)));
+        }
+
+        void
+        deallocate(T*, size_t)
+        {
+            // Memory is freed with the whole arena.
+        }
+
+        template<class U>
+        bool
+        operator==(const Allocator<U>& other) const
+        {
+            return state == other.state;
+        }
+
+        template<class U>
+        bool
+        operator!=(const Allocator<U>& other) const
+        {
+            return state != other.state;
+        }
+
+    private:
+        template<class U>
+        friend class Allocator;
+
+        std::shared_ptr<State> state;
+    };
+
+    std::shared_ptr<State> state;
+
+    /** Size of the first chunk of the next arena. */
+    size_t next_chunk_size = MIN_CHUNK_SIZE;
+};
+
+#endif /* _PAYLOAD_ARENA_H_ */
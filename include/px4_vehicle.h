@@ -13,6 +13,15 @@
 #define MODEL_TYPHOON_H520 6021
 
 #include <mavlink_vehicle.h>
+#include <mission_dump_writer.h>
+#include <path_simplifier.h>
+#include <payload_arena.h>
+#include <rtt_estimator.h>
+#include <seqlock.h>
+#include <timer_wheel.h>
+#include <bitset>
+#include <deque>
+#include <unordered_map>
 
 #define PX4_VERSION(maj, min, patch) ((maj << 24) + (min << 16) + (patch << 8))
 
@@ -50,6 +59,9 @@ public:
             mission_dump_path,
             std::forward<Args>(args)...),
         vehicle_command(*this),
+        mission_write(*this),
+        mission_cache_check(*this),
+        telemetry_setup(*this),
         task_upload(*this)
     {
         Set_autopilot_type("px4");
@@ -72,6 +84,83 @@ public:
     virtual void
     Handle_ucs_command(ugcs::vsm::Ucs_request::Ptr ucs_request);
 
+    /** Use given timer wheel instead of own one. Should be called before
+     * the vehicle is enabled. */
+    void
+    Set_timer_wheel(Timer_wheel::Ptr wheel);
+
+    /** Create timer wheel ticked in the given completion context. Ticking
+     * stops while the wheel has no armed timers. */
+    static Timer_wheel::Ptr
+    Create_timer_wheel(ugcs::vsm::Request_completion_context::Ptr comp);
+
+    /** Timer wheel for retry and control timers. Can be shared by vehicles
+     * of the same completion context. Declared before the activities, so
+     * it outlives their timers. */
+    Timer_wheel::Ptr timer_wheel;
+
+    /** Get timer wheel, own wheel is created if none was set. */
+    Timer_wheel&
+    Get_timer_wheel();
+
+    /** Use given mission dump writer instead of own one. Should be called
+     * before the vehicle is enabled. */
+    void
+    Set_mission_dump_writer(Mission_dump_writer::Ptr writer);
+
+    /** Get mission dump writer, own writer is created if none was set. */
+    Mission_dump_writer&
+    Get_mission_dump_writer();
+
+    /** Vehicle state published for readers outside of the vehicle context.
+     * Latitudes, longitudes and heading are in radians, altitudes in meters.
+     */
+    struct State_snapshot {
+        /** Incremented on each published change, 0 if nothing was published. */
+        uint64_t version = 0;
+        /** When the snapshot was published. */
+        std::chrono::steady_clock::time_point updated;
+        bool home_valid = false;
+        double home_latitude = 0;
+        double home_longitude = 0;
+        double home_altitude_amsl = 0;
+        /** PX4 custom mode from the heartbeat. */
+        uint32_t native_flight_mode = 0;
+        /** proto::Flight_mode, -1 if unknown. */
+        int flight_mode = -1;
+        /** proto::Control_mode, -1 if unknown. */
+        int control_mode = -1;
+        bool is_armed = false;
+        bool is_airborne = false;
+        bool position_valid = false;
+        double latitude = 0;
+        double longitude = 0;
+        float altitude_amsl = 0;
+        /** Altitude above home. */
+        float altitude_relative = 0;
+        /** NaN if unknown. */
+        float heading = 0;
+        float ground_speed = 0;
+        /** Positive up. */
+        float vertical_speed = 0;
+        /** GPS_FIX_TYPE. */
+        int gps_fix = 0;
+        /** -1 if unknown. */
+        int satellites = -1;
+        /** Volts, NaN if unknown. */
+        float battery_voltage = 0;
+        /** Percent, -1 if unknown. */
+        int battery_remaining = -1;
+    };
+
+    /** Get the last published state. Lock-free and callable from any
+     * thread, does not post anything to the vehicle context. */
+    State_snapshot
+    Get_state_snapshot() const
+    {
+        return state_snapshot.Load();
+    }
+
     /** PX4 specific activity. */
     class Px4_activity : public Activity {
     public:
@@ -99,21 +188,112 @@ public:
     void
     On_parameter(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::PARAM_VALUE>::Ptr);
 
+    /** Remember parameter value reported by the vehicle. Called for each
+     * PARAM_VALUE from On_parameter only. */
+    void
+    Cache_parameter(const ugcs::vsm::mavlink::Pld_param_value& value);
+
+    /** Check if the vehicle is known to have the parameter set to the
+     * value. Value is compared bitwise as PX4 sends integers in float. */
+    bool
+    Is_parameter_cached(const std::string& name, float value);
+
+    /** Remove parameters which the vehicle already has from the list. */
+    void
+    Filter_cached_parameters(Write_parameters::List& list);
+
     void
     Download_mission();
 
     void
     On_mission_item(ugcs::vsm::mavlink::Pld_mission_item mi);
 
+    /** Name of the mission cache file of this vehicle. */
+    std::string
+    Get_mission_cache_file_name();
+
+    /** Read item hashes of the cached mission. Returns false if there is
+     * no valid cache for this vehicle. */
+    bool
+    Load_mission_cache(std::vector<uint32_t>& hashes);
+
+    /** Write item hashes, as they are accumulated into the route id, to
+     * the cache file. Cache file is removed if hashes are empty, i.e. the
+     * mission on the vehicle is unknown. */
+    void
+    Save_mission_cache(const std::vector<uint32_t>& hashes);
+
+    /** Report route id of the cached mission. Cached hashes are not used
+     * for partial upload, as only sampled items are validated. */
+    void
+    Restore_cached_mission(std::vector<uint32_t> hashes);
+
     // This handler is disabling the respective message.
     template<ugcs::vsm::mavlink::MESSAGE_ID_TYPE id>
     void
     Disable_message_on_receive(typename ugcs::vsm::mavlink::Message<id>::Ptr) {
-        if (set_message_interval_supported) {
-            Set_message_interval(id, -1);
+        static_assert(id < DISABLED_MESSAGES_MAX, "Message id does not fit the disabled messages bitmap");
+        if (!set_message_interval_supported) {
+            return;
         }
+        if (disabled_messages.test(id) && std::chrono::steady_clock::now() < disable_retries[id].next) {
+            // Already asked to stop, the vehicle has not caught up yet.
+            return;
+        }
+        Request_message_stop(id);
+    }
+
+    // Ask the vehicle to stop sending the message. Repeated requests for the
+    // same message are spaced with exponential backoff.
+    void
+    Request_message_stop(int id);
+
+    // Mission protocol message sent by the vehicle. Addressed to another
+    // system means other software is transferring the mission.
+    template<ugcs::vsm::mavlink::MESSAGE_ID_TYPE id>
+    void
+    On_mission_traffic(typename ugcs::vsm::mavlink::Message<id>::Ptr message) {
+        auto target = message->payload->target_system.Get();
+        if (target != vsm_system_id) {
+            On_foreign_mission_traffic(target, id == ugcs::vsm::mavlink::MESSAGE_ID::MISSION_ACK);
+        }
+    }
+
+    // Forget what is known about the mission on the vehicle. Mission is
+    // downloaded again when the other transfer is over.
+    void
+    On_foreign_mission_traffic(int system_id, bool finished);
+
+    // Counts received telemetry for adaptive rate control.
+    template<ugcs::vsm::mavlink::MESSAGE_ID_TYPE id>
+    void
+    On_telemetry_message(typename ugcs::vsm::mavlink::Message<id>::Ptr) {
+        telemetry_received++;
     }
 
+    void
+    On_sys_status(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::SYS_STATUS>::Ptr);
+
+    void
+    On_global_position_int(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::GLOBAL_POSITION_INT>::Ptr);
+
+    void
+    On_gps_raw_int(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::GPS_RAW_INT>::Ptr);
+
+    /** Request to the vehicle had to be repeated. Used as uplink loss
+     * indication by the adaptive telemetry rate control. */
+    void
+    Report_link_error();
+
+    /** Rate to request for telemetry message, scaled by adaptive rate
+     * control. */
+    float
+    Get_telemetry_rate(int message_id);
+
+    /** Periodic adaptive telemetry rate control. */
+    bool
+    Telemetry_control_timer();
+
     void
     On_mission_downloaded(bool, std::string);
 
@@ -147,8 +327,30 @@ public:
         void
         On_mission_current(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::MISSION_CURRENT>::Ptr);
 
+        /** Response to the in flight message at given index received.
+         * Sends the next group when the whole group is done. */
         void
-        Send_next_command();
+        Complete_command(size_t index);
+
+        /** Send the next group of messages which can be executed without
+         * waiting for each other. */
+        void
+        Send_next_group();
+
+        /** Message does not depend on the result of preceding messages and
+         * can be sent without waiting for their responses. */
+        static bool
+        Is_independent(const ugcs::vsm::mavlink::Payload_base::Ptr& cmd);
+
+        /** Get command id to match COMMAND_ACK against, or message id for
+         * other messages. */
+        static int
+        Get_ack_command_id(const ugcs::vsm::mavlink::Payload_base::Ptr& cmd);
+
+        /** Get parameter name of PARAM_SET or PARAM_REQUEST_READ, empty for
+         * other messages. */
+        static std::string
+        Get_param_name(const ugcs::vsm::mavlink::Payload_base::Ptr& cmd);
 
         /** Status text recieved. */
         void
@@ -167,6 +369,10 @@ public:
         void
         Schedule_timer();
 
+        /** Set current timeout from the vehicle RTT estimate. */
+        void
+        Update_timeout();
+
         /** Register status text handler. */
         void
         Register_status_text();
@@ -251,20 +457,258 @@ public:
             float speed = 1.0f);
 
         /** Mavlink messages to be sent to execute current command. */
-        std::list<ugcs::vsm::mavlink::Payload_base::Ptr> cmd_messages;
+        std::deque<ugcs::vsm::mavlink::Payload_base::Ptr> cmd_messages;
+
+        /** Storage of cmd_messages payloads, released when command chain
+         * is over. */
+        Payload_arena arena;
 
         /** Remaining attempts towards vehicle. */
         size_t remaining_attempts = 0;
 
+        /** Current command was sent at least once, so next send is a retry. */
+        bool sent = false;
+
+        /** Number of messages at the front of cmd_messages sent to the
+         * vehicle and waiting for response. */
+        size_t in_flight = 0;
+
         /** Retry timer. */
-        ugcs::vsm::Timer_processor::Timer::Ptr timer;
+        Timer_wheel::Timer timer {[this]() { return Try(); }};
 
         /** Current timeout to use when scheduling timer. */
         std::chrono::milliseconds current_timeout;
 
+        /** When the current group was sent for the first time. */
+        std::chrono::steady_clock::time_point group_sent_at;
+
+        /** Current group was sent more than once, responses are not used
+         * as RTT samples. */
+        bool retransmitted = false;
+
+        /** STATUSTEXT indicated long command execution, timeout is
+         * extended to extended_retry_timeout. */
+        bool extended = false;
+
         float command_count = 0; // for progress reporting
     } vehicle_command;
 
+    /** Uploads mission to the vehicle. Either the whole mission is uploaded
+     * (MISSION_COUNT) or ranges of it are written using the partial mission
+     * write protocol (MISSION_WRITE_PARTIAL_LIST). Each item is sent when
+     * the vehicle requests it, PX4 discards items sent ahead. After partial
+     * write, or none if nothing changed, the current item is set as the
+     * full upload does. */
+    class Mission_write: public Px4_activity {
+    public:
+        using Px4_activity::Px4_activity;
+
+        /** Inclusive range of mission item sequence numbers. */
+        struct Range {
+            size_t first;
+            size_t last;
+        };
+
+        /** Start uploading all items. */
+        void
+        Enable();
+
+        /** Start writing given ranges of items, then make current_seq the
+         * current item. */
+        void
+        Enable(std::vector<Range> ranges, size_t current_seq);
+
+        /** Disable this class and cancel any existing request. */
+        virtual void
+        On_disable() override;
+
+        /** Register handlers and start the first range. */
+        void
+        Start();
+
+        /** Start writing the current range. */
+        void
+        Start_range();
+
+        /** Start setting the current item. */
+        void
+        Start_set_current();
+
+        /** Send MISSION_SET_CURRENT. */
+        void
+        Send_set_current();
+
+        /** Send MISSION_COUNT or MISSION_WRITE_PARTIAL_LIST for the current range. */
+        void
+        Send_list();
+
+        /** Retry the last sent message. */
+        bool
+        Try();
+
+        /** Schedule timer for retry operation. */
+        void
+        Schedule_timer();
+
+        /** Vehicle requested item with given sequence number. */
+        void
+        On_item_requested(size_t seq);
+
+        void
+        On_mission_request(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::MISSION_REQUEST>::Ptr);
+
+        void
+        On_mission_request_int(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::MISSION_REQUEST_INT>::Ptr);
+
+        void
+        On_mission_ack(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::MISSION_ACK>::Ptr);
+
+        void
+        On_mission_current(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::MISSION_CURRENT>::Ptr);
+
+        /** Complete mission ready to be sent, indexed by seq. Either
+         * MISSION_ITEM or MISSION_ITEM_INT payloads. */
+        std::vector<ugcs::vsm::mavlink::Payload_base::Ptr> items;
+
+        /** Whole mission is uploaded. */
+        bool full = false;
+
+        /** Ranges to write. */
+        std::vector<Range> ranges;
+
+        /** Index of the range being written. */
+        size_t current_range = 0;
+
+        /** Item made current after partial write. */
+        size_t current_seq = 0;
+
+        /** All ranges are written, waiting for MISSION_CURRENT. */
+        bool setting_current = false;
+
+        /** Last item requested by the vehicle in the current range, if any. */
+        ugcs::vsm::Optional<size_t> last_requested;
+
+        /** Set when the vehicle refused partial write instead of a
+         * transfer failure in the middle of the range. */
+        bool rejected = false;
+
+        /** Remaining attempts towards vehicle. */
+        size_t remaining_attempts = 0;
+
+        /** Retry timer. */
+        Timer_wheel::Timer timer {[this]() { return Try(); }};
+    } mission_write;
+
+    /** Sets telemetry message intervals and verifies them. Each stream
+     * gets SET_MESSAGE_INTERVAL followed by GET_MESSAGE_INTERVAL, the rate
+     * is confirmed by MESSAGE_INTERVAL which carries the message id.
+     * COMMAND_ACK is not used, as it can not be told apart from acks of
+     * other interval requests. Only streams not confirmed are retried. */
+    class Telemetry_setup: public Px4_activity {
+    public:
+        using Px4_activity::Px4_activity;
+
+        /** Start setting up streams from telemetry_rates. */
+        void
+        Enable();
+
+        /** Disable this class and cancel any existing request. */
+        virtual void
+        On_disable() override;
+
+        /** Retry streams which are not confirmed yet. */
+        bool
+        Try();
+
+        /** Schedule timer for retry operation. */
+        void
+        Schedule_timer();
+
+        /** Send SET_MESSAGE_INTERVAL for the stream. */
+        void
+        Send_set_interval(int message_id);
+
+        /** Send GET_MESSAGE_INTERVAL for the stream. */
+        void
+        Send_get_interval(int message_id);
+
+        /** Report effective rates and finish. */
+        void
+        Complete();
+
+        void
+        On_message_interval(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::MESSAGE_INTERVAL>::Ptr);
+
+        /** Setup state of one telemetry stream. */
+        struct Stream {
+            /** Rate requested from the vehicle, Hz. */
+            float requested_rate = 0;
+            /** Rate reported by the vehicle matches the requested one, Hz. */
+            ugcs::vsm::Optional<float> applied_rate;
+            /** Last rate reported by the vehicle, Hz. */
+            ugcs::vsm::Optional<float> reported_rate;
+        };
+
+        /** Streams being set up, by message id. */
+        std::map<int, Stream> streams;
+
+        /** Remaining attempts towards vehicle. */
+        size_t remaining_attempts = 0;
+
+        /** Retry timer. */
+        Timer_wheel::Timer timer {[this]() { return Try(); }};
+    } telemetry_setup;
+
+    /** Checks if the mission cached on disk is still on the vehicle by
+     * comparing the MISSION_COUNT reported by the vehicle with the cached
+     * item count, then hashes of sampled items read from the vehicle with
+     * the cached ones. Falls back to full mission download otherwise. */
+    class Mission_cache_check: public Px4_activity {
+    public:
+        using Px4_activity::Px4_activity;
+
+        /** Start the check of given cached item hashes. */
+        void
+        Enable(std::vector<uint32_t> hashes);
+
+        /** Disable this class and cancel any existing request. */
+        virtual void
+        On_disable() override;
+
+        /** Send MISSION_REQUEST_LIST, or MISSION_REQUEST for the current
+         * sample once the count is known. */
+        bool
+        Try();
+
+        /** Schedule timer for retry operation. */
+        void
+        Schedule_timer();
+
+        void
+        On_mission_count(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::MISSION_COUNT>::Ptr);
+
+        void
+        On_mission_item(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::MISSION_ITEM>::Ptr);
+
+        /** Maximum number of items read back to validate the cache. */
+        constexpr static size_t SAMPLE_COUNT = 8;
+
+        /** Item hashes from the cache file. */
+        std::vector<uint32_t> hashes;
+
+        /** Sequence numbers of items to compare, empty until MISSION_COUNT. */
+        std::vector<size_t> samples;
+
+        /** Index of the sample being requested. */
+        size_t current_sample = 0;
+
+        /** Remaining attempts towards vehicle. */
+        size_t remaining_attempts = 0;
+
+        /** Retry timer. */
+        Timer_wheel::Timer timer {[this]() { return Try(); }};
+    } mission_cache_check;
+
     /** Data related to task upload processing. */
     class Task_upload: public Px4_activity {
     public:
@@ -372,10 +816,30 @@ public:
         void
         Filter_other_actions();
 
+        /** Remove MOVE actions whose waypoints deviate from the path
+         * between their neighbours less than the simplification tolerance.
+         * Waypoints with wait time or loiter orbit and waypoints adjacent
+         * to other actions are kept. */
+        void
+        Simplify_route();
+
+        /** Format sorted command ids as ranges, e.g. "3-7, 9". */
+        static std::string
+        Format_command_ranges(const std::vector<int>& ids, size_t max_length);
+
         /** Prepare the task for uploading to the vehicle. */
         void
         Prepare_task();
 
+        /** Remove prepared items which do not change vehicle behavior:
+         * repeated waypoints at the same position, heading waypoints
+         * followed by a waypoint with the same heading and state setting
+         * commands which do not change the state. Renumbers the items and
+         * rebuilds the command mapping. Commands left without items are
+         * reported to UCS. */
+        void
+        Compact_mission();
+
         /** Prepare task attributes depending on the vehicle type. */
         void
         Prepare_task_attributes();
@@ -404,6 +868,40 @@ public:
         void
         Mission_uploaded(bool success, std::string error_msg);
 
+        /** Partial mission write handler. Falls back to full upload on failure. */
+        void
+        Partial_mission_uploaded(bool success, std::string error_msg);
+
+        /** Upload prepared mission. Only changed items are written if the
+         * mission on the vehicle is known and has the same item count. */
+        void
+        Upload_mission();
+
+        /** Upload all prepared mission items. */
+        void
+        Upload_full_mission();
+
+        /** Build items for mission write from prepared actions. */
+        void
+        Fill_mission_write_items();
+
+        /** Write prepared mission to the dump file, if configured. */
+        void
+        Dump_mission();
+
+        /** Format prepared mission as WPL text, for native route export. */
+        std::string
+        Export_native_route(bool crlf);
+
+        /** Get WPL fields of prepared mission item. */
+        static Wpl_item
+        Make_wpl_item(ugcs::vsm::mavlink::Pld_mission_item& mi);
+
+        /** Get ranges of prepared items which differ from the mission
+         * last uploaded to the vehicle. Item counts must be equal. */
+        std::vector<Mission_write::Range>
+        Get_changed_ranges();
+
         /**
          * Fill coordinates into Mavlink message based on ugcs::vsm::Geodetic_tuple and
          * some other common mission item data structures.
@@ -436,6 +934,52 @@ public:
          */
         ugcs::vsm::mavlink::Payload_list prepared_actions;
 
+        /** Storage of prepared mission item payloads, released when upload
+         * is over. */
+        Payload_arena arena;
+
+        /** Approximate arena space taken by one prepared mission item. */
+        constexpr static size_t ARENA_BYTES_PER_ITEM = 256;
+
+        /** Data gathered for each prepared mission item. */
+        struct Item_info {
+            /** Item hash as accumulated into the route id. */
+            uint32_t hash = 0;
+            /** Hash compared with uploaded_mission to find changed items.
+             * Includes exact coordinates if items are sent as
+             * MISSION_ITEM_INT. */
+            uint32_t write_hash = 0;
+            /** Item has exact position below. */
+            bool has_position = false;
+            /** Latitude in degrees * 1E7. */
+            int32_t latitude = 0;
+            /** Longitude in degrees * 1E7. */
+            int32_t longitude = 0;
+            /** Id of the command the item was prepared for. */
+            int command_id = 0;
+        };
+
+        /** Calculate hash and write_hash of the prepared item. */
+        void
+        Set_item_hashes(ugcs::vsm::mavlink::Pld_mission_item& msg, Item_info& info);
+
+        /** Build MISSION_ITEM_INT with exact coordinates from mission item. */
+        ugcs::vsm::mavlink::Pld_mission_item_int::Ptr
+        Build_mission_item_int(ugcs::vsm::mavlink::Pld_mission_item& mi, const Item_info& info);
+
+        /** Info of prepared mission items, indexed by seq. */
+        std::vector<Item_info> prepared_info;
+
+        /** Id of the command being prepared. */
+        int current_command_id = 0;
+
+        /** Ids of MOVE commands removed by route simplification. */
+        std::vector<int> merged_commands;
+
+        /** Exact position of the item built but not yet added to prepared
+         * actions, degrees * 1E7. Empty if the item has no position. */
+        ugcs::vsm::Optional<std::pair<int32_t, int32_t>> pending_position;
+
         /** Task attributes to be written to the vehicle. */
         Write_parameters::List task_attributes;
 
@@ -551,6 +1095,15 @@ private:
     void
     Update_capability_states();
 
+    /** Commit state to UCS. Commits are coalesced to at most one per
+     * ucs_commit_period. Used for all commits, call it wherever telemetry
+     * or command state changes. */
+    void
+    Schedule_commit();
+
+    bool
+    Commit_timer();
+
     /** Load parameters from configuration. */
     void
     Configure_common();
@@ -569,15 +1122,93 @@ private:
     void
     Stop_direct_vehicle_control();
 
+    /** Handle direct vehicle and payload control commands without the
+     * vehicle_command activity. Returns false if the request should take
+     * the regular path. */
+    bool
+    Handle_direct_control(ugcs::vsm::Ucs_request::Ptr ucs_request);
+
+    /** Direct payload control input from UCS. */
+    void
+    On_direct_payload_control(float pitch, float yaw);
+
+    bool
+    Gimbal_control_timer();
+
+    /** Send the current payload_pitch and payload_yaw to the gimbal. */
+    void
+    Send_gimbal_control();
+
+    void
+    On_gimbal_command_ack(ugcs::vsm::mavlink::Message<ugcs::vsm::mavlink::MESSAGE_ID::COMMAND_ACK>::Ptr);
+
+    /** Apply payload control input to payload_pitch and payload_yaw. */
+    void
+    Update_payload_attitude(float pitch, float yaw);
+
+    /** Fresh joystick input from UCS. */
+    void
+    On_direct_vehicle_control(int p, int r, int t, int y);
+
     bool
     Direct_vehicle_control_timer();
 
+    /** Log joystick latency statistics collected since the last report. */
+    void
+    Report_joystick_latency();
+
     void
     Send_direct_vehicle_control();
 
     void
     Set_direct_vehicle_control(int p, int r, int t, int y);
 
+    // Parameters of a direct control command by field id. Learned from the
+    // first command, reused for the next ones to avoid building parameter
+    // lists for each joystick sample.
+    struct Direct_control_fields {
+        std::unordered_map<int, ugcs::vsm::Property::Ptr> by_id;
+        ugcs::vsm::Property::Ptr pitch;
+        ugcs::vsm::Property::Ptr roll;
+        ugcs::vsm::Property::Ptr yaw;
+        ugcs::vsm::Property::Ptr throttle;
+    };
+
+    Direct_control_fields direct_vehicle_control_fields;
+
+    Direct_control_fields direct_payload_control_fields;
+
+    // Gimbal control message reused for direct payload control.
+    ugcs::vsm::mavlink::Pld_command_long::Ptr gimbal_control;
+
+    // MAV_CMD_DO_GIMBAL_MANAGER_PITCHYAW, not in the SDK dialect.
+    static constexpr int CMD_DO_GIMBAL_MANAGER_PITCHYAW = 1000;
+
+    // Gimbal manager commands are accepted by the vehicle. Unknown until
+    // the first acknowledgement, MOUNT_CONTROL is sent along meanwhile.
+    ugcs::vsm::Optional<bool> gimbal_manager_supported;
+
+    // Fall back to MOUNT_CONTROL if gimbal manager commands are not
+    // acknowledged by this time. Set by the first gimbal manager command.
+    ugcs::vsm::Optional<std::chrono::steady_clock::time_point> gimbal_manager_probe_deadline;
+
+    // Probe lasts this many command retry timeouts.
+    static constexpr int GIMBAL_MANAGER_PROBE_RTTS = 3;
+
+    // Retry timeout used for the probe before any RTT is measured.
+    constexpr static std::chrono::milliseconds GIMBAL_MANAGER_PROBE_TIMEOUT {1000};
+
+    // Period of streamed gimbal control. Zero sends each sample once.
+    // Set by vehicle.px4.gimbal_rate.
+    std::chrono::milliseconds gimbal_period {0};
+
+    // Streaming stops when there is no input for this time.
+    constexpr static std::chrono::milliseconds GIMBAL_STREAM_TIMEOUT {1000};
+
+    std::chrono::steady_clock::time_point gimbal_last_input;
+
+    Timer_wheel::Timer gimbal_timer {[this]() { return Gimbal_control_timer(); }};
+
     // MANUAL_CONTROL message which holds the latest joystick values.
     // Existence of this messages means that vehicle is in joystick mode.
     ugcs::vsm::mavlink::Pld_manual_control::Ptr direct_vehicle_control = nullptr;
@@ -594,12 +1225,60 @@ private:
     // received from ucs.
     constexpr static std::chrono::milliseconds MANUAL_CONTROL_TIMEOUT {3000};
 
-    // Timeout when to revert back to manual mode if no joystick messages
-    // received from ucs.
+    // Default period of MANUAL_CONTROL messages.
     constexpr static std::chrono::milliseconds MANUAL_CONTROL_PERIOD {200};
 
+    // MANUAL_CONTROL messages are sent with this period and never more often.
+    // Set by vehicle.px4.joystick_rate.
+    std::chrono::milliseconds direct_vehicle_control_period = MANUAL_CONTROL_PERIOD;
+
+    // Joystick input is held in the buffer for this time before it is sent,
+    // to smooth uneven arrival from ucs. Zero sends input immediately.
+    std::chrono::milliseconds joystick_jitter_delay {0};
+
+    // Joystick input waiting in the jitter buffer.
+    struct Joystick_input {
+        std::chrono::steady_clock::time_point received;
+        int p, r, t, y;
+    };
+
+    std::deque<Joystick_input> joystick_inputs;
+
+    // Jitter buffer size limit, oldest inputs are dropped.
+    constexpr static size_t JOYSTICK_INPUTS_MAX = 32;
+
+    // Arrival time of the input in direct_vehicle_control not sent yet.
+    ugcs::vsm::Optional<std::chrono::steady_clock::time_point> joystick_input_time;
+
+    // Input arrival to send latency statistics, in milliseconds.
+    struct Joystick_latency {
+        size_t count = 0;
+        double sum = 0;
+        double max = 0;
+    } joystick_latency;
+
+    std::chrono::steady_clock::time_point joystick_latency_reported;
+
+    constexpr static std::chrono::seconds JOYSTICK_LATENCY_REPORT_PERIOD {10};
+
+    // Tick period of timer wheels.
+    constexpr static std::chrono::milliseconds TIMER_WHEEL_TICK {10};
+
+    // Advance the wheel, stops ticking when the wheel is idle or destroyed.
+    static bool
+    Timer_wheel_tick(std::weak_ptr<Timer_wheel> wheel);
+
     // Timer instance for sending MANUAL_CONTROL messages.
-    ugcs::vsm::Timer_processor::Timer::Ptr direct_vehicle_control_timer = nullptr;
+    Timer_wheel::Timer direct_vehicle_control_timer {[this]() { return Direct_vehicle_control_timer(); }};
+
+    // Vehicle state the command capabilities were last calculated from.
+    ugcs::vsm::Optional<uint64_t> capability_state;
+
+    // Pending state changes are committed to UCS when this timer fires.
+    Timer_wheel::Timer commit_timer {[this]() { return Commit_timer(); }};
+
+    // Minimal time between state commits to UCS. Zero commits immediately.
+    std::chrono::milliseconds ucs_commit_period {100};
 
     /** End direct vehicle control functionality */
 
@@ -647,6 +1326,36 @@ private:
 
     bool is_airborne = false;
 
+    // Message ids which fit the disabled messages bitmap.
+    constexpr static size_t DISABLED_MESSAGES_MAX = 256;
+
+    // Messages the vehicle was asked to stop sending.
+    std::bitset<DISABLED_MESSAGES_MAX> disabled_messages;
+
+    struct Disable_retry {
+        // Next request to stop the message is not sent before this.
+        std::chrono::steady_clock::time_point next;
+        std::chrono::milliseconds interval;
+    };
+
+    // Backoff of repeated requests by message id, for ids set in disabled_messages.
+    std::unordered_map<int, Disable_retry> disable_retries;
+
+    // First repeated request to stop a message is sent after this.
+    constexpr static std::chrono::milliseconds DISABLE_RETRY_MIN {1000};
+
+    constexpr static std::chrono::milliseconds DISABLE_RETRY_MAX {60000};
+
+    // State of the vehicle context, copied to state_snapshot by Publish_state().
+    State_snapshot state;
+
+    // Published state, read from any thread by Get_state_snapshot().
+    Seqlock<State_snapshot> state_snapshot;
+
+    // Publish current state for readers on other threads.
+    void
+    Publish_state();
+
     // camera pitch and yaw starting positions
     float payload_pitch = 0;
     float payload_yaw = 0;
@@ -657,11 +1366,69 @@ private:
     // Keep the current configured rates for each message type.
     std::map<int, float> telemetry_rates;
 
+    // Rates confirmed by the vehicle for each message type.
+    std::map<int, float> effective_telemetry_rates;
+
+    // Applied rate within this fraction of the requested one is accepted.
+    constexpr static float TELEMETRY_RATE_TOLERANCE = 0.1;
+
+    // Calculate expected_telemetry_rate from effective or configured rates.
+    void
+    Update_expected_telemetry_rate();
+
+    // Scale telemetry rates down when the link is saturated and back up
+    // when there is headroom.
+    bool adaptive_telemetry = false;
+
+    // Factor applied to configured telemetry rates, 1 means as configured.
+    float telemetry_scale = 1;
+
+    // Telemetry messages received in the current control period.
+    size_t telemetry_received = 0;
+
+    // Repeated requests in the current control period.
+    size_t link_errors = 0;
+
+    // Uplink drop rate reported by the vehicle, percent.
+    float uplink_drop_rate = 0;
+
+    // Consecutive control periods without congestion.
+    int healthy_periods = 0;
+
+    // Timer instance for adaptive telemetry rate control.
+    ugcs::vsm::Timer_processor::Timer::Ptr telemetry_control_timer;
+
+    constexpr static std::chrono::milliseconds TELEMETRY_CONTROL_PERIOD {5000};
+
+    // Link is congested if less than this fraction of expected telemetry arrives.
+    constexpr static float TELEMETRY_RECEIVED_MIN = 0.75;
+
+    // Link is congested if vehicle drops more than this percentage of packets.
+    constexpr static float UPLINK_DROP_RATE_MAX = 10;
+
+    // Link is congested after this many repeated requests in a period.
+    constexpr static size_t LINK_ERRORS_MAX = 2;
+
+    // Lowest telemetry_scale.
+    constexpr static float TELEMETRY_SCALE_MIN = 0.1;
+
+    // telemetry_scale is increased by this after TELEMETRY_HEALTHY_PERIODS.
+    constexpr static float TELEMETRY_SCALE_STEP = 0.1;
+
+    constexpr static int TELEMETRY_HEALTHY_PERIODS = 3;
+
     Px4_custom_mode native_flight_mode;
 
     // Value read from MPC_XY_VEL_MAX on vehicle connect.
     float max_ground_speed = 0;
 
+    // Last known parameter values as raw float bits, by name. Filled from
+    // every PARAM_VALUE received from the vehicle.
+    std::unordered_map<std::string, uint32_t> parameter_cache;
+
+    // Round trip time of vehicle commands, sets command retry timeouts.
+    Rtt_estimator command_rtt;
+
     // true when VSM has understood which mavlink version the vehicle supports.
     bool protocol_version_detected = false;
 
@@ -674,6 +1441,55 @@ private:
     // Current mission hash.
     uint32_t current_route_id;
 
+    // Item write hashes of the mission last uploaded to and accepted by the
+    // vehicle, or item hashes of the downloaded mission. Downloaded items
+    // carry float coordinates only, so their positional items never match
+    // items written as MISSION_ITEM_INT. Empty if mission on the vehicle
+    // is unknown.
+    std::vector<uint32_t> uploaded_mission;
+
+    // Item hashes of the mission being downloaded from the vehicle.
+    std::vector<uint32_t> downloaded_mission;
+
+    // Directory to keep last known mission of each vehicle in.
+    // Mission cache is disabled if not set.
+    ugcs::vsm::Optional<std::string> mission_cache_path;
+
+    // System id of VSM in outgoing messages, see mavlink.vsm_system_id.
+    int vsm_system_id = 1;
+
+    // Writes mission dumps off the vehicle context. Shared by vehicles of
+    // the manager, own one is created on first dump otherwise.
+    Mission_dump_writer::Ptr mission_dump_writer;
+
+    // Combination of Mission_dump_writer::Format flags.
+    int mission_dump_formats = Mission_dump_writer::FORMAT_TEXT;
+
+    // true if vehicle accepts MISSION_ITEM_INT.
+    bool mission_item_int_supported = false;
+
+    // Remove redundant prepared mission items before upload.
+    bool mission_compaction = false;
+
+    // Maximum deviation from the uploaded path of a waypoint removed by route
+    // simplification, meters. Simplification is disabled if 0.
+    double route_simplification_tolerance = 0;
+
+    constexpr static double ROUTE_SIMPLIFICATION_TOLERANCE_MAX = 100;
+
+    // Mean Earth radius for local projections of routes, meters.
+    constexpr static double EARTH_RADIUS = 6371000;
+
+    // Merged command ids reported in the status message are cut to this length.
+    constexpr static size_t MERGED_COMMANDS_STATUS_MAX = 200;
+
+    // Cleared when vehicle refuses MISSION_WRITE_PARTIAL_LIST.
+    bool partial_mission_write_supported = true;
+
+    // Changed items closer than this are written in one range to save
+    // the round trips of starting a new partial write.
+    constexpr static size_t PARTIAL_WRITE_MERGE_GAP = 3;
+
     /** by default autoheading is turned on */
     bool autoheading = true;
 
@@ -10,6 +10,7 @@
 
 #include <mavlink_vehicle_manager.h>
 #include <px4_vehicle.h>
+#include <map>
 
 class Px4_vehicle_manager: public Mavlink_vehicle_manager {
     DEFINE_COMMON_CLASS(Px4_vehicle_manager, Mavlink_vehicle_manager)
@@ -18,7 +19,7 @@ public:
     /** Constructor. */
     Px4_vehicle_manager();
 
-private:
+protected:
     virtual Mavlink_vehicle::Ptr
     Create_mavlink_vehicle(
             ugcs::vsm::Mavlink_demuxer::System_id system_id,
@@ -32,6 +33,15 @@ private:
             ugcs::vsm::Request_processor::Ptr proc,
             ugcs::vsm::Request_completion_context::Ptr comp) override;
 
+    /** Get timer wheel shared by vehicles of given completion context. */
+    Timer_wheel::Ptr
+    Get_timer_wheel(ugcs::vsm::Request_completion_context::Ptr comp);
+
+    /** Get mission dump writer shared by all vehicles. */
+    Mission_dump_writer::Ptr
+    Get_mission_dump_writer();
+
+private:
     virtual void
     Register_detectors() override;
 
@@ -39,6 +49,13 @@ private:
     On_manager_disable();
 
     Px4_vehicle::Ptr copter_processor;
+
+    /** Timer wheels by completion context. Wheels are owned by vehicles. */
+    std::map<ugcs::vsm::Request_completion_context::Ptr, std::weak_ptr<Timer_wheel>> timer_wheels;
+
+    /** Mission dump writer of all vehicles, one thread for any number of
+     * vehicles. */
+    Mission_dump_writer::Ptr mission_dump_writer;
 };
 
 #endif /* _PX4_VEHICLE_MANAGER_H_ */
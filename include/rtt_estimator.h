@@ -0,0 +1,75 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file rtt_estimator.h
+ */
+#ifndef _RTT_ESTIMATOR_H_
+#define _RTT_ESTIMATOR_H_
+
+#include <chrono>
+
+/** Round trip time estimator for retry timeouts, as in TCP (RFC 6298).
+ * Keeps smoothed RTT and its variance from response times of requests
+ * which were sent only once (Karn's algorithm), timeout is doubled on each
+ * retransmission until a new sample arrives.
+ */
+class Rtt_estimator {
+public:
+    /** Timeout is never shorter than this. */
+    constexpr static std::chrono::milliseconds TIMEOUT_MIN {200};
+
+    /** Timeout is never longer than this, including backoff. */
+    constexpr static std::chrono::milliseconds TIMEOUT_MAX {30000};
+
+    /** Add response time of a request which was not retransmitted. Resets
+     * the backoff. */
+    void
+    Add_sample(std::chrono::steady_clock::duration rtt);
+
+    /** Request was retransmitted, double the timeout. */
+    void
+    Backoff();
+
+    /** Get retry timeout.
+     * @param initial Timeout to use while there are no samples yet.
+     */
+    std::chrono::milliseconds
+    Get_timeout(std::chrono::milliseconds initial) const;
+
+    /** Check if at least one sample was taken. */
+    bool
+    Has_samples() const
+    {
+        return samples != 0;
+    }
+
+    /** Smoothed RTT in milliseconds. */
+    double
+    Get_srtt() const
+    {
+        return srtt;
+    }
+
+    /** RTT variation in milliseconds. */
+    double
+    Get_rttvar() const
+    {
+        return rttvar;
+    }
+
+private:
+    /** Smoothed RTT in milliseconds. */
+    double srtt = 0;
+
+    /** RTT variation in milliseconds. */
+    double rttvar = 0;
+
+    unsigned samples = 0;
+
+    /** Number of timeout doublings. */
+    unsigned backoff = 0;
+};
+
+#endif /* _RTT_ESTIMATOR_H_ */
@@ -0,0 +1,92 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file seqlock.h
+ */
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+/** Sequence lock for a trivially copyable value with a single writer.
+ * Writer never waits, readers never block the writer: a reader copies
+ * the value and retries if a write happened meanwhile. The value is kept
+ * in atomic words, so concurrent copies are not data races.
+ */
+template<typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock value must be trivially copyable");
+
+public:
+    explicit Seqlock(const T& value = T())
+    {
+        Copy_in(value);
+    }
+
+    Seqlock(const Seqlock&) = delete;
+
+    Seqlock&
+    operator=(const Seqlock&) = delete;
+
+    /** Publish new value. Must not be called concurrently. */
+    void
+    Store(const T& value)
+    {
+        auto seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Copy_in(value);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    /** Get consistent copy of the last published value. Thread safe. */
+    T
+    Load() const
+    {
+        uint64_t copy[WORDS];
+        while (true) {
+            auto seq = sequence.load(std::memory_order_acquire);
+            if (seq & 1) {
+                // Writer is in the middle of a store.
+                std::this_thread::yield();
+                continue;
+            }
+            for (size_t i = 0; i < WORDS; i++) {
+                copy[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == seq) {
+                break;
+            }
+        }
+        T value;
+        memcpy(&value, copy, sizeof(value));
+        return value;
+    }
+
+private:
+    constexpr static size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    void
+    Copy_in(const T& value)
+    {
+        uint64_t copy[WORDS] = {};
+        memcpy(copy, &value, sizeof(value));
+        for (size_t i = 0; i < WORDS; i++) {
+            words[i].store(copy[i], std::memory_order_relaxed);
+        }
+    }
+
+    /** Odd while a store is in progress. */
+    std::atomic<uint64_t> sequence {0};
+
+    std::atomic<uint64_t> words[WORDS];
+};
+
+#endif /* _SEQLOCK_H_ */
@@ -0,0 +1,196 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file timer_wheel.h
+ */
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+/** Hierarchical timer wheel shared by vehicles of one completion context.
+ * Timers are owned by the user and linked into wheel slots intrusively, so
+ * arming, re-arming and cancelling a timer is O(1) and does not allocate.
+ *
+ * The wheel does not run by itself, Advance() should be called periodically
+ * with the tick period. To avoid ticking idle wheels, Advance() reports when
+ * the last timer is gone and the wakeup handler is invoked when a timer is
+ * armed again.
+ *
+ * Not thread safe, must be used from a single completion context.
+ */
+class Timer_wheel {
+public:
+    typedef std::shared_ptr<Timer_wheel> Ptr;
+
+    typedef std::chrono::steady_clock Clock;
+
+    /** Timer handler. Return true to re-arm the timer with the same
+     * interval, like Timer_processor timers do. Handler may arm and cancel
+     * any timers but must not destroy its own timer. */
+    typedef std::function<bool()> Handler;
+
+    /** Called when the wheel needs ticking again after being idle. */
+    typedef std::function<void()> Wakeup_handler;
+
+private:
+    /** Intrusive list link. */
+    struct Link {
+        Link* prev = this;
+        Link* next = this;
+    };
+
+public:
+    /** Timer which can be armed in a wheel. Disarmed on destruction. */
+    class Timer: private Link {
+    public:
+        explicit Timer(Handler handler = Handler()):
+            handler(std::move(handler)) {}
+
+        Timer(const Timer&) = delete;
+
+        Timer&
+        operator=(const Timer&) = delete;
+
+        ~Timer()
+        {
+            Cancel();
+        }
+
+        /** Set handler invoked on timer expiration. */
+        void
+        Set_handler(Handler handler)
+        {
+            this->handler = std::move(handler);
+        }
+
+        /** Check if the timer is armed in some wheel. */
+        bool
+        Is_armed() const
+        {
+            return wheel != nullptr;
+        }
+
+        /** Disarm the timer, no-op if not armed. */
+        void
+        Cancel();
+
+    private:
+        friend class Timer_wheel;
+
+        Handler handler;
+
+        /** Wheel the timer is armed in, nullptr if not armed. */
+        Timer_wheel* wheel = nullptr;
+
+        /** Tick at which the timer expires. */
+        uint64_t expires = 0;
+
+        /** Interval used when the handler asks for re-arm. */
+        std::chrono::milliseconds interval {0};
+    };
+
+    /** Create wheel with given tick period. */
+    explicit Timer_wheel(std::chrono::milliseconds tick);
+
+    Timer_wheel(const Timer_wheel&) = delete;
+
+    Timer_wheel&
+    operator=(const Timer_wheel&) = delete;
+
+    /** Disarms all remaining timers. */
+    ~Timer_wheel();
+
+    /** Set handler called when first timer is armed in an idle wheel. */
+    void
+    Set_wakeup_handler(Wakeup_handler handler);
+
+    /** Arm the timer to expire after given interval. Timer already armed is
+     * re-armed. Expiration is rounded up to the tick period. */
+    void
+    Arm(Timer& timer, std::chrono::milliseconds interval);
+
+    /** Advance the wheel to the given time invoking handlers of expired
+     * timers.
+     * @return true if armed timers remain and the wheel should be ticked
+     *      further, false if the wheel has become idle.
+     */
+    bool
+    Advance(Clock::time_point now = Clock::now());
+
+    /** Number of armed timers. */
+    size_t
+    Get_armed_count() const
+    {
+        return armed_count;
+    }
+
+    /** Tick period. */
+    std::chrono::milliseconds
+    Get_tick() const
+    {
+        return tick;
+    }
+
+private:
+    /** Bits of tick counter per wheel level. */
+    constexpr static unsigned LEVEL_BITS = 6;
+
+    /** Number of slots per level. */
+    constexpr static uint64_t LEVEL_SLOTS = 1 << LEVEL_BITS;
+
+    constexpr static uint64_t SLOT_MASK = LEVEL_SLOTS - 1;
+
+    /** Number of levels. Covers 2^24 ticks, longer intervals are
+     * clamped. */
+    constexpr static unsigned LEVELS = 4;
+
+    constexpr static uint64_t MAX_DELTA = (uint64_t(1) << (LEVEL_BITS * LEVELS)) - 1;
+
+    /** Ticks since the wheel creation at given time, rounded down. */
+    uint64_t
+    Get_ticks(Clock::time_point time) const;
+
+    /** Arm disarmed timer to expire at given tick. */
+    void
+    Schedule(Timer& timer, uint64_t expires, std::chrono::milliseconds interval);
+
+    /** Link timer into the slot matching its expiration. */
+    void
+    Insert(Timer& timer);
+
+    /** Re-insert timers of higher level slots which become due for lower
+     * levels at the current tick. */
+    void
+    Cascade();
+
+    static void
+    Unlink(Link& link);
+
+    /** Move all links from one list to another empty list. */
+    static void
+    Splice(Link& from, Link& to);
+
+    std::chrono::milliseconds tick;
+
+    Clock::time_point start_time;
+
+    /** Last processed tick. */
+    uint64_t current = 0;
+
+    size_t armed_count = 0;
+
+    /** Wheel is being ticked by its user. */
+    bool ticking = false;
+
+    Wakeup_handler wakeup_handler;
+
+    Link slots[LEVELS][LEVEL_SLOTS];
+};
+
+#endif /* _TIMER_WHEEL_H_ */
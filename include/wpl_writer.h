@@ -0,0 +1,67 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file wpl_writer.h
+ */
+#ifndef _WPL_WRITER_H_
+#define _WPL_WRITER_H_
+
+#include <cstdint>
+#include <string>
+
+/** Mission item fields written to WPL and mission dumps. */
+struct Wpl_item {
+    float param1;
+    float param2;
+    float param3;
+    float param4;
+    float x;
+    float y;
+    float z;
+    uint16_t seq;
+    uint16_t command;
+    uint8_t frame;
+    uint8_t current;
+    uint8_t autocontinue;
+};
+
+/** Formats mission items as QGC WPL 110 text appended to a caller owned
+ * string, so the result can be moved on without copies. Floats are
+ * formatted with 8 decimals without printf and locale lookups, the output
+ * is the same as of "%.8f".
+ */
+class Wpl_writer {
+public:
+    /** Maximum length of one formatted line. */
+    constexpr static size_t LINE_MAX = 512;
+
+    /** Typical length of one formatted line, used to reserve the output. */
+    constexpr static size_t LINE_SIZE = 112;
+
+    /** Append WPL header to out and reserve space for item_count items. */
+    Wpl_writer(std::string& out, bool crlf, size_t item_count = 0);
+
+    Wpl_writer(const Wpl_writer&) = delete;
+
+    Wpl_writer&
+    operator=(const Wpl_writer&) = delete;
+
+    /** Append one item line. */
+    void
+    Write(const Wpl_item& item);
+
+private:
+    static char*
+    Format_int(char* pos, int64_t value);
+
+    static char*
+    Format_float(char* pos, float value);
+
+    std::string& out;
+
+    const char* eol;
+};
+
+#endif /* _WPL_WRITER_H_ */
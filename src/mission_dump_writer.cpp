@@ -0,0 +1,157 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <mission_dump_writer.h>
+#include <ugcs/vsm/log.h>
+#include <cstdio>
+#include <cstring>
+
+constexpr char Mission_dump_writer::BINARY_MAGIC[8];
+constexpr size_t Mission_dump_writer::BINARY_ITEM_SIZE;
+constexpr size_t Mission_dump_writer::QUEUE_MAX;
+
+namespace {
+
+void
+Append_le(std::string& out, uint32_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+void
+Append_float(std::string& out, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    Append_le(out, bits, 4);
+}
+
+void
+Format_text(std::string& out, const std::vector<Wpl_item>& items)
+{
+    Wpl_writer writer(out, false, items.size());
+    for (auto& item : items) {
+        writer.Write(item);
+    }
+}
+
+void
+Format_binary(std::string& out, const std::vector<Wpl_item>& items)
+{
+    out.reserve(sizeof(Mission_dump_writer::BINARY_MAGIC) + 4 +
+        items.size() * Mission_dump_writer::BINARY_ITEM_SIZE);
+    out.append(Mission_dump_writer::BINARY_MAGIC, sizeof(Mission_dump_writer::BINARY_MAGIC));
+    Append_le(out, items.size(), 4);
+    for (auto& item : items) {
+        Append_le(out, item.seq, 2);
+        Append_le(out, item.command, 2);
+        Append_le(out, item.frame, 1);
+        Append_le(out, item.current, 1);
+        Append_le(out, item.autocontinue, 1);
+        Append_le(out, 0, 1);
+        Append_float(out, item.param1);
+        Append_float(out, item.param2);
+        Append_float(out, item.param3);
+        Append_float(out, item.param4);
+        Append_float(out, item.x);
+        Append_float(out, item.y);
+        Append_float(out, item.z);
+    }
+}
+
+} /* anonymous namespace */
+
+Mission_dump_writer::Mission_dump_writer(size_t queue_max):
+    queue_max(queue_max),
+    thread(&Mission_dump_writer::Run, this)
+{
+}
+
+Mission_dump_writer::~Mission_dump_writer()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+bool
+Mission_dump_writer::Write(std::string file_name, std::vector<Wpl_item> items, int formats)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (queue.size() >= queue_max) {
+            dropped++;
+            return false;
+        }
+        queue.push_back({std::move(file_name), std::move(items), formats});
+    }
+    cv.notify_one();
+    return true;
+}
+
+void
+Mission_dump_writer::Run()
+{
+    std::deque<Job> batch;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this]() { return stop || !queue.empty(); });
+        if (queue.empty()) {
+            // Stopped and drained.
+            return;
+        }
+        // Take all queued dumps at once, the queue is free for new ones
+        // while these are written.
+        batch.swap(queue);
+        lock.unlock();
+        for (auto& job : batch) {
+            Write_job(job);
+        }
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void
+Mission_dump_writer::Write_job(const Job& job)
+{
+    if (job.formats & FORMAT_TEXT) {
+        buffer.clear();
+        Format_text(buffer, job.items);
+        if (!Write_file(job.file_name, buffer)) {
+            LOG_WRN("Could not write mission dump file %s", job.file_name.c_str());
+        }
+    }
+    if (job.formats & FORMAT_BINARY) {
+        buffer.clear();
+        Format_binary(buffer, job.items);
+        auto file_name = job.file_name + ".bin";
+        if (!Write_file(file_name, buffer)) {
+            LOG_WRN("Could not write mission dump file %s", file_name.c_str());
+        }
+    }
+}
+
+bool
+Mission_dump_writer::Write_file(const std::string& file_name, const std::string& data)
+{
+    auto file = fopen(file_name.c_str(), "wb");
+    if (!file) {
+        failed++;
+        return false;
+    }
+    // Single write of the whole dump, no stdio buffering needed.
+    setvbuf(file, nullptr, _IONBF, 0);
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        failed++;
+    }
+    return ok;
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <path_simplifier.h>
+#include <cmath>
+#include <utility>
+
+Path_simplifier::Path_simplifier(double tolerance):
+    tolerance(tolerance)
+{
+}
+
+void
+Path_simplifier::Add_point(double x, double y, double z, bool anchor)
+{
+    if (anchor) {
+        anchors.push_back(points.size());
+    }
+    points.push_back({x, y, z});
+}
+
+std::vector<bool>
+Path_simplifier::Simplify() const
+{
+    std::vector<bool> keep(points.size(), false);
+    if (points.empty()) {
+        return keep;
+    }
+    size_t first = 0;
+    for (auto anchor : anchors) {
+        Simplify(first, anchor, keep);
+        first = anchor;
+    }
+    Simplify(first, points.size() - 1, keep);
+    return keep;
+}
+
+void
+Path_simplifier::Simplify(size_t first, size_t last, std::vector<bool>& keep) const
+{
+    keep[first] = true;
+    keep[last] = true;
+    // Explicit stack, dense routes would recurse too deep.
+    std::vector<std::pair<size_t, size_t>> ranges;
+    if (last > first + 1) {
+        ranges.emplace_back(first, last);
+    }
+    while (!ranges.empty()) {
+        auto range = ranges.back();
+        ranges.pop_back();
+        double max_distance = 0;
+        size_t farthest = range.first;
+        for (auto i = range.first + 1; i < range.second; i++) {
+            auto distance = Get_distance(points[i], points[range.first], points[range.second]);
+            if (distance > max_distance) {
+                max_distance = distance;
+                farthest = i;
+            }
+        }
+        if (max_distance <= tolerance) {
+            continue;
+        }
+        keep[farthest] = true;
+        if (farthest > range.first + 1) {
+            ranges.emplace_back(range.first, farthest);
+        }
+        if (range.second > farthest + 1) {
+            ranges.emplace_back(farthest, range.second);
+        }
+    }
+}
+
+double
+Path_simplifier::Get_distance(const Point& p, const Point& a, const Point& b)
+{
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    double dz = b.z - a.z;
+    double px = p.x - a.x;
+    double py = p.y - a.y;
+    double pz = p.z - a.z;
+    double length2 = dx * dx + dy * dy + dz * dz;
+    double t = 0;
+    if (length2 > 0) {
+        // Nearest point of the segment, not of the whole line.
+        t = (px * dx + py * dy + pz * dz) / length2;
+        if (t < 0) {
+            t = 0;
+        } else if (t > 1) {
+            t = 1;
+        }
+    }
+    px -= t * dx;
+    py -= t * dy;
+    pz -= t * dz;
+    return std::sqrt(px * px + py * py + pz * pz);
+}
@@ -3,6 +3,15 @@
 // See LICENSE file for license details.
 
 #include <px4_vehicle.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <tuple>
+#include <unordered_set>
 
 constexpr float Px4_vehicle::MAX_COPTER_SPEED;
 
@@ -10,11 +19,22 @@ using namespace ugcs::vsm;
 
 constexpr std::chrono::milliseconds Px4_vehicle::MANUAL_CONTROL_PERIOD;
 constexpr std::chrono::milliseconds Px4_vehicle::MANUAL_CONTROL_TIMEOUT;
+constexpr std::chrono::milliseconds Px4_vehicle::TIMER_WHEEL_TICK;
+constexpr std::chrono::seconds Px4_vehicle::JOYSTICK_LATENCY_REPORT_PERIOD;
+constexpr std::chrono::milliseconds Px4_vehicle::GIMBAL_STREAM_TIMEOUT;
+constexpr int Px4_vehicle::GIMBAL_MANAGER_PROBE_RTTS;
+constexpr std::chrono::milliseconds Px4_vehicle::GIMBAL_MANAGER_PROBE_TIMEOUT;
+constexpr std::chrono::milliseconds Px4_vehicle::TELEMETRY_CONTROL_PERIOD;
+constexpr std::chrono::milliseconds Px4_vehicle::DISABLE_RETRY_MIN;
+constexpr std::chrono::milliseconds Px4_vehicle::DISABLE_RETRY_MAX;
 
 // Constructor for command processor.
 Px4_vehicle::Px4_vehicle(proto::Vehicle_type type):
         Mavlink_vehicle(Vendor::PX4, "px4", type),
         vehicle_command(*this),
+        mission_write(*this),
+        mission_cache_check(*this),
+        telemetry_setup(*this),
         task_upload(*this),
         set_poi_supported(true)
 {
@@ -38,7 +58,7 @@ Px4_vehicle::On_enable()
         // Just register it with UCS.
         Register();
         // Send command availability.
-        Commit_to_ucs();
+        Schedule_commit();
         return;
     }
 
@@ -70,7 +90,7 @@ Px4_vehicle::On_enable()
     c_set_poi->Set_available();
     c_set_poi->Set_enabled();
 
-    Commit_to_ucs();    // push state info.
+    Schedule_commit();    // push state info.
 
     if (use_mavlink_2 && *use_mavlink_2) {
         mav_stream->Set_mavlink_v2(true);
@@ -100,6 +120,26 @@ Px4_vehicle::On_enable()
     REG_DISABLER(WIND_COV);
     REG_DISABLER(VIBRATION);
 
+    if (adaptive_telemetry) {
+        #define REG_TELEMETRY(x) \
+        common_handlers.Register_mavlink_handler<mavlink::x>(&Px4_vehicle::On_telemetry_message<mavlink::x>, this)
+
+        REG_TELEMETRY(ALTITUDE);
+        REG_TELEMETRY(ATTITUDE);
+        REG_TELEMETRY(VFR_HUD);
+    }
+
+    // State snapshot, also counted by the adaptive telemetry.
+    common_handlers.Register_mavlink_handler<mavlink::MESSAGE_ID::SYS_STATUS>(
+        &Px4_vehicle::On_sys_status,
+        this);
+    common_handlers.Register_mavlink_handler<mavlink::MESSAGE_ID::GLOBAL_POSITION_INT>(
+        &Px4_vehicle::On_global_position_int,
+        this);
+    common_handlers.Register_mavlink_handler<mavlink::MESSAGE_ID::GPS_RAW_INT>(
+        &Px4_vehicle::On_gps_raw_int,
+        this);
+
     // Home location handler.
     common_handlers.Register_mavlink_handler<mavlink::MESSAGE_ID::HOME_POSITION>(
         &Px4_vehicle::On_home_position,
@@ -126,6 +166,20 @@ Px4_vehicle::On_enable()
         &Px4_vehicle::On_parameter,
         this);
 
+    common_handlers.Register_mavlink_handler<mavlink::MESSAGE_ID::COMMAND_ACK>(
+        &Px4_vehicle::On_gimbal_command_ack,
+        this,
+        Mavlink_demuxer::COMPONENT_ID_ANY);
+
+    // Mission changes made by other software.
+    #define REG_MISSION_TRAFFIC(x) \
+    common_handlers.Register_mavlink_handler<mavlink::x>(&Px4_vehicle::On_mission_traffic<mavlink::x>, \
+        this, Mavlink_demuxer::COMPONENT_ID_ANY)
+
+    REG_MISSION_TRAFFIC(MISSION_REQUEST);
+    REG_MISSION_TRAFFIC(MISSION_REQUEST_INT);
+    REG_MISSION_TRAFFIC(MISSION_ACK);
+
     // Get autopilot version
     auto cmd_long = mavlink::Pld_command_long::Create();
     (*cmd_long)->target_component = real_component_id;
@@ -149,13 +203,71 @@ Px4_vehicle::On_disable()
     if (device_type == proto::DEVICE_TYPE_VEHICLE_COMMAND_PROCESSOR) {
         return;
     }
-    if (direct_vehicle_control_timer) {
-        direct_vehicle_control_timer->Cancel();
+    direct_vehicle_control_timer.Cancel();
+    gimbal_timer.Cancel();
+    if (telemetry_control_timer) {
+        telemetry_control_timer->Cancel();
+        telemetry_control_timer = nullptr;
     }
+    commit_timer.Cancel();
     read_waypoints.item_handler = Read_waypoints::Mission_item_handler();
+    mission_cache_check.Disable();
+    telemetry_setup.Disable();
     Mavlink_vehicle::On_disable();
 }
 
+void
+Px4_vehicle::Set_timer_wheel(Timer_wheel::Ptr wheel)
+{
+    timer_wheel = wheel;
+}
+
+Timer_wheel&
+Px4_vehicle::Get_timer_wheel()
+{
+    if (!timer_wheel) {
+        timer_wheel = Create_timer_wheel(Get_completion_ctx());
+    }
+    return *timer_wheel;
+}
+
+void
+Px4_vehicle::Set_mission_dump_writer(Mission_dump_writer::Ptr writer)
+{
+    mission_dump_writer = writer;
+}
+
+Mission_dump_writer&
+Px4_vehicle::Get_mission_dump_writer()
+{
+    if (!mission_dump_writer) {
+        mission_dump_writer = std::make_shared<Mission_dump_writer>();
+    }
+    return *mission_dump_writer;
+}
+
+Timer_wheel::Ptr
+Px4_vehicle::Create_timer_wheel(Request_completion_context::Ptr comp)
+{
+    auto wheel = std::make_shared<Timer_wheel>(TIMER_WHEEL_TICK);
+    std::weak_ptr<Timer_wheel> weak_wheel = wheel;
+    // Single Timer_processor timer drives all timers of the wheel.
+    wheel->Set_wakeup_handler([weak_wheel, comp]() {
+        Timer_processor::Get_instance()->Create_timer(
+            TIMER_WHEEL_TICK,
+            Make_callback(&Px4_vehicle::Timer_wheel_tick, weak_wheel),
+            comp);
+    });
+    return wheel;
+}
+
+bool
+Px4_vehicle::Timer_wheel_tick(std::weak_ptr<Timer_wheel> weak_wheel)
+{
+    auto wheel = weak_wheel.lock();
+    return wheel && wheel->Advance();
+}
+
 void
 Px4_vehicle::On_autopilot_version(
     mavlink::Message<mavlink::MESSAGE_ID::AUTOPILOT_VERSION>::Ptr ver)
@@ -174,6 +286,10 @@ Px4_vehicle::On_autopilot_version(
         LOG_INFO("Enabled MAVLINK2");
     }
 
+    if (ver->payload->capabilities & mavlink::MAV_PROTOCOL_CAPABILITY_MISSION_INT) {
+        mission_item_int_supported = true;
+    }
+
     if (maj > 1 || (maj == 1 && min >= 4)) {
         set_message_interval_supported = true;
     }
@@ -195,7 +311,12 @@ Px4_vehicle::On_autopilot_version(
         (*cmd_long_set_mode)->param1 = 1;
         Send_message(*cmd_long_set_mode);
         read_parameters.Enable({"SYS_AUTOSTART", "GF_ACTION", "MPC_XY_VEL_MAX"});
-        Download_mission();
+        std::vector<uint32_t> hashes;
+        if (Load_mission_cache(hashes)) {
+            mission_cache_check.Enable(std::move(hashes));
+        } else {
+            Download_mission();
+        }
     }
 }
 
@@ -268,8 +389,14 @@ Px4_vehicle::On_home_position(mavlink::Message<mavlink::MESSAGE_ID::HOME_POSITIO
             t_home_latitude->Set_value(lat);
             t_home_longitude->Set_value(lon);
             t_home_altitude_amsl->Set_value(alt);
+            // Commits home position too.
             Calculate_current_route_id();
             Set_altitude_origin(home_location.altitude);
+            state.home_valid = true;
+            state.home_latitude = lat;
+            state.home_longitude = lon;
+            state.home_altitude_amsl = alt;
+            Publish_state();
         }
     }
 }
@@ -280,6 +407,8 @@ Px4_vehicle::On_parameter(
 {
     const auto &name = m->payload->param_id.Get_string();
 
+    Cache_parameter(m->payload);
+
     if (name == "SYS_AUTOSTART") {
         float v = m->payload->param_value.Get();
         // PX4 copies int values into float directly without conversion.
@@ -297,17 +426,53 @@ Px4_vehicle::On_parameter(
     } else if (name == "GF_ACTION") {
         // This works because float zero is the same bitwise representation as int zero.
         t_fence_enabled->Set_value(m->payload->param_value.Get() != 0);
-        Commit_to_ucs();
+        Schedule_commit();
     } else if (name == "MPC_XY_VEL_MAX") {
         max_ground_speed = m->payload->param_value.Get();
     }
 }
 
+void
+Px4_vehicle::Cache_parameter(const mavlink::Pld_param_value& value)
+{
+    float v = value->param_value.Get();
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    parameter_cache[value->param_id.Get_string()] = bits;
+}
+
+bool
+Px4_vehicle::Is_parameter_cached(const std::string& name, float value)
+{
+    auto it = parameter_cache.find(name);
+    if (it == parameter_cache.end()) {
+        return false;
+    }
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return it->second == bits;
+}
+
+void
+Px4_vehicle::Filter_cached_parameters(Write_parameters::List& list)
+{
+    for (auto iter = list.begin(); iter != list.end();) {
+        auto name = (*iter)->param_id.Get_string();
+        if (Is_parameter_cached(name, (*iter)->param_value.Get())) {
+            VEHICLE_LOG_DBG(*this, "Parameter %s already set, not writing.", name.c_str());
+            iter = list.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+}
+
 void
 Px4_vehicle::Download_mission()
 {
     if (!read_waypoints.In_progress()) {
         current_command_map.Reset();
+        downloaded_mission.clear();
         read_waypoints.Enable();
     }
 }
@@ -315,10 +480,121 @@ Px4_vehicle::Download_mission()
 void
 Px4_vehicle::On_mission_item(mavlink::Pld_mission_item mi)
 {
-    current_command_map.Accumulate_route_id(Get_mission_item_hash(mi));
+    auto hash = Get_mission_item_hash(mi);
+    current_command_map.Accumulate_route_id(hash);
+    downloaded_mission.push_back(hash);
 //    VEHICLE_LOG_DBG(*this, "Item %d received. mission_id=%08X", mi->seq.Get(), current_command_map.Get_route_id());
 }
 
+std::string
+Px4_vehicle::Get_mission_cache_file_name()
+{
+    auto name = serial_number;
+    for (auto& c : name) {
+        if (!isalnum(c) && c != '-' && c != '_') {
+            c = '_';
+        }
+    }
+    return *mission_cache_path + "/" + name + ".mission";
+}
+
+bool
+Px4_vehicle::Load_mission_cache(std::vector<uint32_t>& hashes)
+{
+    if (!mission_cache_path) {
+        return false;
+    }
+    auto file_name = Get_mission_cache_file_name();
+    std::ifstream file(file_name);
+    if (!file) {
+        return false;
+    }
+    std::string key;
+    uint32_t route_id = 0;
+    size_t count = 0;
+    file >> key >> std::hex >> route_id;
+    if (!file || key != "route_id") {
+        VEHICLE_LOG_WRN(*this, "Invalid mission cache file %s", file_name.c_str());
+        return false;
+    }
+    file >> key >> std::dec >> count;
+    if (!file || key != "count") {
+        VEHICLE_LOG_WRN(*this, "Invalid mission cache file %s", file_name.c_str());
+        return false;
+    }
+    hashes.clear();
+    hashes.reserve(count);
+    uint32_t hash;
+    while (file >> std::hex >> hash) {
+        hashes.push_back(hash);
+    }
+    if (hashes.size() != count) {
+        VEHICLE_LOG_WRN(*this, "Invalid mission cache file %s", file_name.c_str());
+        hashes.clear();
+        return false;
+    }
+    VEHICLE_LOG_INF(*this, "Loaded cached mission_id=%08X with %zu items.", route_id, count);
+    return true;
+}
+
+void
+Px4_vehicle::Save_mission_cache(const std::vector<uint32_t>& hashes)
+{
+    if (!mission_cache_path) {
+        return;
+    }
+    auto file_name = Get_mission_cache_file_name();
+    if (hashes.empty()) {
+        // Mission on the vehicle is unknown, do not let stale cache be used.
+        std::remove(file_name.c_str());
+        return;
+    }
+    std::ofstream file(file_name, std::ios::trunc);
+    if (!file) {
+        VEHICLE_LOG_WRN(*this, "Could not open mission cache file %s", file_name.c_str());
+        return;
+    }
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%08X", current_route_id);
+    file << "route_id " << buf << "\n";
+    file << "count " << hashes.size() << "\n";
+    for (auto hash : hashes) {
+        snprintf(buf, sizeof(buf), "%08X", hash);
+        file << buf << "\n";
+    }
+}
+
+void
+Px4_vehicle::Restore_cached_mission(std::vector<uint32_t> hashes)
+{
+    current_command_map.Reset();
+    for (auto hash : hashes) {
+        current_command_map.Accumulate_route_id(hash);
+    }
+    // Only sampled items are checked, so the cached hashes can not be
+    // trusted for partial upload. Next upload writes the whole mission.
+    uploaded_mission.clear();
+    Calculate_current_route_id();
+    VEHICLE_LOG_INF(*this, "Mission restored from cache. mission_id=%08X", current_route_id);
+    Schedule_commit();
+}
+
+void
+Px4_vehicle::On_foreign_mission_traffic(int system_id, bool finished)
+{
+    if (!uploaded_mission.empty()) {
+        VEHICLE_LOG_INF(*this, "Mission transfer with system %d seen, mission on the vehicle is unknown.",
+            system_id);
+        uploaded_mission.clear();
+    }
+    // Removes the cache file, the running check can not be trusted either.
+    Save_mission_cache({});
+    mission_cache_check.Disable();
+    if (finished && !task_upload.In_progress()) {
+        Download_mission();
+    }
+}
+
 void
 Px4_vehicle::Calculate_current_route_id()
 {
@@ -329,33 +605,182 @@ Px4_vehicle::Calculate_current_route_id()
     current_route_id = current_command_map.Get_route_id();
     VEHICLE_LOG_DBG(*this, "New mission_id=%08X", current_route_id);
     t_current_mission_id->Set_value(current_route_id);
+    Schedule_commit();
 }
 
 void
-Px4_vehicle::On_mission_downloaded(bool, std::string)
+Px4_vehicle::On_mission_downloaded(bool success, std::string)
 {
     Calculate_current_route_id();
     VEHICLE_LOG_DBG(*this, "Mission_downloaded. mission_id=%08X", current_route_id);
-    Commit_to_ucs();
+    if (success) {
+        uploaded_mission = std::move(downloaded_mission);
+    } else {
+        uploaded_mission.clear();
+    }
+    Save_mission_cache(uploaded_mission);
+    downloaded_mission.clear();
+    Schedule_commit();
 }
 
 void
 Px4_vehicle::Initialize_telemetry()
 {
     if (set_message_interval_supported) {
-        for (auto it : telemetry_rates)
-        {
-            // Send message twice to be sure.
-            // TODO: Rework this to verify the actual interval used by px4.
-            // Need to refactor the Send_message to include response handler.
-            Set_message_interval(it.first, 1000000.0 / it.second);
-            Set_message_interval(it.first, 1000000.0 / it.second);
+        telemetry_setup.Disable();
+        telemetry_setup.Enable();
+        if (adaptive_telemetry && !telemetry_control_timer) {
+            telemetry_control_timer = Timer_processor::Get_instance()->Create_timer(
+                TELEMETRY_CONTROL_PERIOD,
+                Make_callback(&Px4_vehicle::Telemetry_control_timer, Shared_from_this()),
+                Get_completion_ctx());
         }
     } else {
         Mavlink_vehicle::Initialize_telemetry();
     }
 }
 
+void
+Px4_vehicle::On_sys_status(mavlink::Message<mavlink::MESSAGE_ID::SYS_STATUS>::Ptr message)
+{
+    auto p = message->payload;
+    if (adaptive_telemetry) {
+        telemetry_received++;
+        // Reported in c%.
+        uplink_drop_rate = p->drop_rate_comm.Get() / 100.0;
+    }
+    auto voltage = p->voltage_battery.Get();
+    state.battery_voltage = voltage == UINT16_MAX ? NAN : voltage / 1000.0;
+    state.battery_remaining = p->battery_remaining.Get();
+    Publish_state();
+}
+
+void
+Px4_vehicle::On_global_position_int(mavlink::Message<mavlink::MESSAGE_ID::GLOBAL_POSITION_INT>::Ptr message)
+{
+    if (adaptive_telemetry) {
+        telemetry_received++;
+    }
+    auto p = message->payload;
+    state.position_valid = true;
+    state.latitude = static_cast<double>(p->lat.Get()) / 10000000 * M_PI / 180;
+    state.longitude = static_cast<double>(p->lon.Get()) / 10000000 * M_PI / 180;
+    state.altitude_amsl = p->alt.Get() / 1000.0;
+    state.altitude_relative = p->relative_alt.Get() / 1000.0;
+    auto hdg = p->hdg.Get();
+    state.heading = hdg == UINT16_MAX ? NAN : hdg / 100.0 * M_PI / 180;
+    // Velocities are in cm/s, NED.
+    state.ground_speed = std::hypot(p->vx.Get(), p->vy.Get()) / 100.0;
+    state.vertical_speed = -p->vz.Get() / 100.0;
+    Publish_state();
+}
+
+void
+Px4_vehicle::On_gps_raw_int(mavlink::Message<mavlink::MESSAGE_ID::GPS_RAW_INT>::Ptr message)
+{
+    if (adaptive_telemetry) {
+        telemetry_received++;
+    }
+    auto p = message->payload;
+    state.gps_fix = p->fix_type.Get();
+    auto satellites = p->satellites_visible.Get();
+    state.satellites = satellites == UINT8_MAX ? -1 : satellites;
+    Publish_state();
+}
+
+void
+Px4_vehicle::Publish_state()
+{
+    state.version++;
+    state.updated = std::chrono::steady_clock::now();
+    state_snapshot.Store(state);
+}
+
+void
+Px4_vehicle::Request_message_stop(int id)
+{
+    auto& retry = disable_retries[id];
+    if (disabled_messages.test(id)) {
+        retry.interval = std::min(retry.interval * 2, DISABLE_RETRY_MAX);
+        VEHICLE_LOG_DBG(*this, "Message %d still received, disabling again in %d ms.",
+            id, static_cast<int>(retry.interval.count()));
+    } else {
+        disabled_messages.set(id);
+        retry.interval = DISABLE_RETRY_MIN;
+    }
+    retry.next = std::chrono::steady_clock::now() + retry.interval;
+    Set_message_interval(id, -1);
+}
+
+void
+Px4_vehicle::Report_link_error()
+{
+    link_errors++;
+}
+
+float
+Px4_vehicle::Get_telemetry_rate(int message_id)
+{
+    float rate = telemetry_rates[message_id];
+    if (message_id == mavlink::HEARTBEAT) {
+        // Heartbeat is used for link detection, keep it as configured.
+        return rate;
+    }
+    rate *= telemetry_scale;
+    if (rate < 0.1) {
+        rate = 0.1;
+    }
+    return rate;
+}
+
+bool
+Px4_vehicle::Telemetry_control_timer()
+{
+    float expected = expected_telemetry_rate *
+        std::chrono::duration<float>(TELEMETRY_CONTROL_PERIOD).count();
+    float received = expected > 0 ? telemetry_received / expected : 1;
+    bool congested =
+        received < TELEMETRY_RECEIVED_MIN ||
+        uplink_drop_rate > UPLINK_DROP_RATE_MAX ||
+        link_errors >= LINK_ERRORS_MAX;
+    auto errors = link_errors;
+    telemetry_received = 0;
+    link_errors = 0;
+
+    if (!telemetry_setup.streams.empty()) {
+        // Rates are being changed, measurement is not reliable.
+        return true;
+    }
+
+    float scale = telemetry_scale;
+    if (congested) {
+        // Back off fast to leave room for commands and mission transfers.
+        healthy_periods = 0;
+        scale /= 2;
+        if (scale < TELEMETRY_SCALE_MIN) {
+            scale = TELEMETRY_SCALE_MIN;
+        }
+    } else if (++healthy_periods >= TELEMETRY_HEALTHY_PERIODS) {
+        // Probe for headroom slowly.
+        healthy_periods = 0;
+        scale += TELEMETRY_SCALE_STEP;
+        if (scale > 1) {
+            scale = 1;
+        }
+    }
+
+    if (scale != telemetry_scale) {
+        VEHICLE_LOG_INF(*this,
+            "Link %s (received %0.0f%% of telemetry, drop rate %0.1f%%, %zu retries), "
+            "telemetry rates scaled to %0.0f%%.",
+            congested ? "congested" : "has headroom",
+            received * 100, uplink_drop_rate, errors, scale * 100);
+        telemetry_scale = scale;
+        telemetry_setup.Enable();
+    }
+    return true;
+}
+
 bool
 Px4_vehicle::Is_home_position_valid()
 {
@@ -375,6 +800,10 @@ void
 Px4_vehicle::Handle_ucs_command(
     Ucs_request::Ptr ucs_request)
 {
+    if (Handle_direct_control(ucs_request)) {
+        return;
+    }
+
     if (vehicle_command.ucs_request) {
         Command_failed(ucs_request, "Previous request in progress");
         return;
@@ -408,6 +837,204 @@ Px4_vehicle::Handle_ucs_command(
     }
 }
 
+bool
+Px4_vehicle::Handle_direct_control(Ucs_request::Ptr ucs_request)
+{
+    if (ucs_request->request.device_commands_size() != 1) {
+        return false;
+    }
+    auto &vsm_cmd = ucs_request->request.device_commands(0);
+    Vsm_command::Ptr cmd;
+    try {
+        cmd = Get_command(vsm_cmd.command_id());
+    } catch (const std::exception&) {
+        // Unknown command, reported by the regular path.
+        return false;
+    }
+    Direct_control_fields* fields;
+    if (cmd == c_direct_vehicle_control) {
+        if (!Is_control_mode(proto::CONTROL_MODE_JOYSTICK)) {
+            // Let the regular path reject it.
+            return false;
+        }
+        fields = &direct_vehicle_control_fields;
+    } else if (cmd == c_direct_payload_control) {
+        fields = &direct_payload_control_fields;
+    } else {
+        return false;
+    }
+
+    if (fields->by_id.empty()) {
+        // Learn parameter field ids from the first command, the regular
+        // path handles it and reports invalid parameters.
+        try {
+            auto params = cmd->Build_parameter_list(vsm_cmd);
+            auto learn = [&](const char* name, Property::Ptr& field) {
+                auto iter = params.find(name);
+                if (iter != params.end()) {
+                    field = iter->second;
+                    fields->by_id.emplace(field->Get_id(), field);
+                }
+            };
+            learn("pitch", fields->pitch);
+            learn("yaw", fields->yaw);
+            if (cmd == c_direct_vehicle_control) {
+                learn("roll", fields->roll);
+                learn("throttle", fields->throttle);
+            }
+        } catch (const std::exception&) {
+        }
+        if (fields->by_id.size() != (cmd == c_direct_vehicle_control ? 4u : 2u)) {
+            *fields = Direct_control_fields();
+        }
+        return false;
+    }
+
+    size_t found = 0;
+    for (int i = 0; i < vsm_cmd.parameters_size(); i++) {
+        auto &param = vsm_cmd.parameters(i);
+        auto iter = fields->by_id.find(param.parameter_id());
+        if (iter != fields->by_id.end() && iter->second->Set_value(param.value())) {
+            found++;
+        }
+    }
+    if (found != fields->by_id.size()) {
+        return false;
+    }
+
+    float pitch = 0, roll = 0, yaw = 0, throttle = 0;
+    if (fields->pitch) {
+        fields->pitch->Get_value(pitch);
+    }
+    if (fields->roll) {
+        fields->roll->Get_value(roll);
+    }
+    if (fields->yaw) {
+        fields->yaw->Get_value(yaw);
+    }
+    if (fields->throttle) {
+        fields->throttle->Get_value(throttle);
+    }
+
+    if (cmd == c_direct_vehicle_control) {
+        On_direct_vehicle_control(pitch * 1000, roll * 1000, throttle * 1000, yaw * 1000);
+    } else {
+        On_direct_payload_control(pitch, yaw);
+    }
+    Command_succeeded(ucs_request);
+    return true;
+}
+
+void
+Px4_vehicle::On_direct_payload_control(float pitch, float yaw)
+{
+    Update_payload_attitude(pitch, yaw);
+    if (gimbal_period.count() == 0) {
+        // Fire and forget, next sample supersedes a lost one.
+        Send_gimbal_control();
+        return;
+    }
+    // Streaming, samples between timer ticks only update the attitude.
+    gimbal_last_input = std::chrono::steady_clock::now();
+    if (!gimbal_timer.Is_armed()) {
+        Send_gimbal_control();
+        Get_timer_wheel().Arm(gimbal_timer, gimbal_period);
+    }
+}
+
+bool
+Px4_vehicle::Gimbal_control_timer()
+{
+    if (std::chrono::steady_clock::now() - gimbal_last_input > GIMBAL_STREAM_TIMEOUT) {
+        // No input, gimbal holds the last attitude.
+        return false;
+    }
+    Send_gimbal_control();
+    return true;
+}
+
+void
+Px4_vehicle::Send_gimbal_control()
+{
+    if (!gimbal_control) {
+        gimbal_control = mavlink::Pld_command_long::Create();
+        (*gimbal_control)->target_system = real_system_id;
+        (*gimbal_control)->target_component = real_component_id;
+    }
+    auto& cmd = *gimbal_control;
+    if (!gimbal_manager_supported) {
+        auto now = std::chrono::steady_clock::now();
+        if (!gimbal_manager_probe_deadline) {
+            // Give the vehicle a few round trips to acknowledge.
+            gimbal_manager_probe_deadline = now +
+                GIMBAL_MANAGER_PROBE_RTTS * command_rtt.Get_timeout(GIMBAL_MANAGER_PROBE_TIMEOUT);
+        } else if (now > *gimbal_manager_probe_deadline) {
+            VEHICLE_LOG_INF((*this), "No response to gimbal manager commands, using MOUNT_CONTROL.");
+            gimbal_manager_supported = false;
+        }
+    }
+    if (!gimbal_manager_supported || !*gimbal_manager_supported) {
+        // Also sent while probing, so the gimbal follows on any firmware.
+        cmd->command = mavlink::MAV_CMD::MAV_CMD_DO_MOUNT_CONTROL;
+        cmd->param1 = payload_pitch;
+        cmd->param2 = 0;
+        cmd->param3 = payload_yaw;
+        cmd->param4 = 0;
+        cmd->param5 = 0;
+        cmd->param6 = 0;
+        cmd->param7 = mavlink::MAV_MOUNT_MODE::MAV_MOUNT_MODE_MAVLINK_TARGETING;
+        Send_message(cmd);
+    }
+    if (!gimbal_manager_supported || *gimbal_manager_supported) {
+        cmd->command = CMD_DO_GIMBAL_MANAGER_PITCHYAW;
+        cmd->param1 = payload_pitch;
+        cmd->param2 = payload_yaw;
+        // No rate control.
+        cmd->param3 = NAN;
+        cmd->param4 = NAN;
+        // Flags 0: yaw is relative to the vehicle heading, like MOUNT_CONTROL.
+        cmd->param5 = 0;
+        cmd->param6 = 0;
+        // Primary gimbal.
+        cmd->param7 = 0;
+        Send_message(cmd);
+    }
+}
+
+void
+Px4_vehicle::On_gimbal_command_ack(
+    mavlink::Message<mavlink::MESSAGE_ID::COMMAND_ACK>::Ptr message)
+{
+    // Late acceptance after the fallback still switches to gimbal manager.
+    if ((gimbal_manager_supported && *gimbal_manager_supported) ||
+        message->payload->command.Get() != CMD_DO_GIMBAL_MANAGER_PITCHYAW) {
+        return;
+    }
+    auto result = message->payload->result.Get();
+    if (result == mavlink::MAV_RESULT::MAV_RESULT_ACCEPTED) {
+        VEHICLE_LOG_INF((*this), "Gimbal controlled with gimbal manager commands.");
+        gimbal_manager_supported = true;
+    } else if (!gimbal_manager_supported &&
+               (result == mavlink::MAV_RESULT::MAV_RESULT_UNSUPPORTED ||
+                result == mavlink::MAV_RESULT::MAV_RESULT_DENIED)) {
+        VEHICLE_LOG_INF((*this), "Gimbal manager not available (%s), using MOUNT_CONTROL.",
+            Mav_result_to_string(result).c_str());
+        gimbal_manager_supported = false;
+    }
+}
+
+void
+Px4_vehicle::Update_payload_attitude(float pitch, float yaw)
+{
+    payload_pitch += pitch * DIRECT_PAYLOAD_CONTROLLING_COEF;
+    payload_yaw += yaw * DIRECT_PAYLOAD_CONTROLLING_COEF;
+
+    if (payload_pitch > 0) {payload_pitch = 0;}
+    if (payload_pitch < -90) {payload_pitch = -90;}
+    if (payload_yaw > 180) {payload_yaw -= 360;}
+    if (payload_yaw < -180) {payload_yaw += 360;}
+}
+
 void
 Px4_vehicle::Start_direct_vehicle_control()
 {
@@ -415,11 +1042,10 @@ Px4_vehicle::Start_direct_vehicle_control()
         // Create rc_override message. timer will delete it when vehicle switched to other mode.
         direct_vehicle_control = mavlink::Pld_manual_control::Create();
         (*direct_vehicle_control)->target = real_system_id;
-
-        direct_vehicle_control_timer = Timer_processor::Get_instance()->Create_timer(
-            MANUAL_CONTROL_PERIOD,
-            Make_callback(&Px4_vehicle::Direct_vehicle_control_timer, Shared_from_this()),
-            Get_completion_ctx());
+        joystick_inputs.clear();
+        joystick_input_time.Disengage();
+        joystick_latency = Joystick_latency();
+        joystick_latency_reported = std::chrono::steady_clock::now();
     }
     // Set larger timeout when turning on joystick mode
     // to let client more time to understand that joystick commands must be sent, now.
@@ -433,7 +1059,35 @@ Px4_vehicle::Stop_direct_vehicle_control()
 {
     Set_direct_vehicle_control(0, 0, 0, 0);
     Send_direct_vehicle_control();
+    Report_joystick_latency();
     direct_vehicle_control = nullptr;
+    direct_vehicle_control_timer.Cancel();
+    joystick_inputs.clear();
+}
+
+void
+Px4_vehicle::On_direct_vehicle_control(int p, int r, int t, int y)
+{
+    auto now = std::chrono::steady_clock::now();
+    direct_vehicle_control_last_received = now;
+    if (direct_vehicle_control == nullptr) {
+        return;
+    }
+    if (joystick_jitter_delay.count()) {
+        // Played out by the timer at even intervals.
+        if (joystick_inputs.size() >= JOYSTICK_INPUTS_MAX) {
+            joystick_inputs.pop_front();
+        }
+        joystick_inputs.push_back({now, p, r, t, y});
+        return;
+    }
+    Set_direct_vehicle_control(p, r, t, y);
+    joystick_input_time = now;
+    if (now - direct_vehicle_control_last_sent >= direct_vehicle_control_period) {
+        // Fresh input goes out immediately unless the rate limit is hit,
+        // otherwise it is sent by the timer.
+        Send_direct_vehicle_control();
+    }
 }
 
 bool
@@ -451,14 +1105,32 @@ Px4_vehicle::Direct_vehicle_control_timer()
         return false;
     }
 
-    if (now - direct_vehicle_control_last_sent < MANUAL_CONTROL_PERIOD) {
-        // Do not spam radio link too much.
-        return true;
+    // Take the latest input which has spent the jitter delay in the buffer.
+    while (!joystick_inputs.empty() &&
+           now - joystick_inputs.front().received >= joystick_jitter_delay) {
+        auto& input = joystick_inputs.front();
+        Set_direct_vehicle_control(input.p, input.r, input.t, input.y);
+        joystick_input_time = input.received;
+        joystick_inputs.pop_front();
     }
 
+    // Timer is re-armed by every send, so the vehicle receives
+    // MANUAL_CONTROL evenly spaced even when it is not changing.
     Send_direct_vehicle_control();
+    return false;
+}
 
-    return true;
+void
+Px4_vehicle::Report_joystick_latency()
+{
+    if (joystick_latency.count) {
+        VEHICLE_LOG_INF((*this), "Joystick input to send latency: avg %.1f ms, max %.1f ms, %zu inputs.",
+            joystick_latency.sum / joystick_latency.count,
+            joystick_latency.max,
+            joystick_latency.count);
+    }
+    joystick_latency = Joystick_latency();
+    joystick_latency_reported = std::chrono::steady_clock::now();
 }
 
 void
@@ -493,14 +1165,28 @@ Px4_vehicle::Send_direct_vehicle_control()
                         mav_stream),
                 Get_completion_ctx());
 
-        direct_vehicle_control_last_sent = std::chrono::steady_clock::now();
+        auto now = std::chrono::steady_clock::now();
+        direct_vehicle_control_last_sent = now;
+        if (joystick_input_time) {
+            double latency = std::chrono::duration<double, std::milli>(now - *joystick_input_time).count();
+            joystick_latency.count++;
+            joystick_latency.sum += latency;
+            if (latency > joystick_latency.max) {
+                joystick_latency.max = latency;
+            }
+            joystick_input_time.Disengage();
+        }
+        if (now - joystick_latency_reported >= JOYSTICK_LATENCY_REPORT_PERIOD) {
+            Report_joystick_latency();
+        }
+        Get_timer_wheel().Arm(direct_vehicle_control_timer, direct_vehicle_control_period);
     }
 }
 
 void
 Px4_vehicle::Vehicle_command_act::Set_mode(uint8_t main_mode, uint8_t sub_mode)
 {
-    auto cmd_long = mavlink::Pld_command_long::Create();
+    auto cmd_long = arena.Create<mavlink::Pld_command_long>();
     Fill_target_ids(*cmd_long);
 
     (*cmd_long)->command = mavlink::MAV_CMD::MAV_CMD_DO_SET_MODE;
@@ -520,7 +1206,7 @@ Px4_vehicle::Vehicle_command_act::Do_reposition(
     float heading,
     float speed)
 {
-    auto cmd_long = mavlink::Pld_command_long::Create();
+    auto cmd_long = arena.Create<mavlink::Pld_command_long>();
     Fill_target_ids(*cmd_long);
     (*cmd_long)->command = mavlink::MAV_CMD::MAV_CMD_DO_REPOSITION;
     (*cmd_long)->confirmation = 0;
@@ -550,7 +1236,7 @@ Px4_vehicle::Vehicle_command_act::Process_arm()
         return;
     }
 
-    auto cmd_long = mavlink::Pld_command_long::Create();
+    auto cmd_long = arena.Create<mavlink::Pld_command_long>();
     Fill_target_ids(*cmd_long);
     (*cmd_long)->command = mavlink::MAV_CMD::MAV_CMD_COMPONENT_ARM_DISARM;
     (*cmd_long)->param1 = 1;    // arm
@@ -562,7 +1248,7 @@ Px4_vehicle::Vehicle_command_act::Process_arm()
 void
 Px4_vehicle::Vehicle_command_act::Process_disarm()
 {
-    auto cmd_long = mavlink::Pld_command_long::Create();
+    auto cmd_long = arena.Create<mavlink::Pld_command_long>();
     Fill_target_ids(*cmd_long);
     (*cmd_long)->command = mavlink::MAV_CMD::MAV_CMD_COMPONENT_ARM_DISARM;
     (*cmd_long)->param1 = 0;    // disarm
@@ -614,7 +1300,7 @@ Px4_vehicle::Vehicle_command_act::Process_joystick()
 void
 Px4_vehicle::Vehicle_command_act::Process_auto()
 {
-    auto set_current = mavlink::Pld_mission_set_current::Create();
+    auto set_current = arena.Create<mavlink::Pld_mission_set_current>();
     Fill_target_ids(*set_current);
     (*set_current)->seq = 0;
     cmd_messages.emplace_back(set_current);
@@ -671,15 +1357,17 @@ Px4_vehicle::Vehicle_command_act::Process_waypoint(const Property_list& params)
         if (px4_vehicle.vendor == Px4_vendor::YUNEEC) {
             VEHICLE_LOG_WRN(vehicle, "Ignoring speed setting as MPC_XY_CRUISE is not supported by Yuneec.");
         } else {
-            auto param = mavlink::Pld_param_set::Create();
-            Fill_target_ids(*param);
-            (*param)->param_id = "MPC_XY_CRUISE";
-            (*param)->param_type = mavlink::MAV_PARAM_TYPE::MAV_PARAM_TYPE_REAL32;
-            (*param)->param_value = speed;
-            cmd_messages.emplace_back(param);
+            if (!px4_vehicle.Is_parameter_cached("MPC_XY_CRUISE", speed)) {
+                auto param = arena.Create<mavlink::Pld_param_set>();
+                Fill_target_ids(*param);
+                (*param)->param_id = "MPC_XY_CRUISE";
+                (*param)->param_type = mavlink::MAV_PARAM_TYPE::MAV_PARAM_TYPE_REAL32;
+                (*param)->param_value = speed;
+                cmd_messages.emplace_back(param);
+            }
 
             if (px4_vehicle.max_ground_speed < speed) {
-                auto param = mavlink::Pld_param_set::Create();
+                auto param = arena.Create<mavlink::Pld_param_set>();
                 Fill_target_ids(*param);
                 (*param)->param_id = "MPC_XY_VEL_MAX";
                 (*param)->param_type = mavlink::MAV_PARAM_TYPE::MAV_PARAM_TYPE_REAL32;
@@ -703,7 +1391,7 @@ Px4_vehicle::Vehicle_command_act::Process_waypoint(const Property_list& params)
 void
 Px4_vehicle::Vehicle_command_act::Process_set_poi(const Property_list& params)
 {
-    auto cmd_long = mavlink::Pld_command_long::Create();
+    auto cmd_long = arena.Create<mavlink::Pld_command_long>();
     Fill_target_ids(*cmd_long);
     bool active = false;
     params.at("active")->Get_value(active);
@@ -735,15 +1423,15 @@ Px4_vehicle::Vehicle_command_act::Process_direct_payload_control(const Property_
     params.at("yaw")->Get_value(yaw);
     //LOG("Direct payload (py) %1.3f %1.3f", pitch, yaw);
 
-    px4_vehicle.payload_pitch += pitch * DIRECT_PAYLOAD_CONTROLLING_COEF;
-    px4_vehicle.payload_yaw += yaw * DIRECT_PAYLOAD_CONTROLLING_COEF;
+    if (px4_vehicle.gimbal_period.count()) {
+        // Streamed without acknowledgement.
+        px4_vehicle.On_direct_payload_control(pitch, yaw);
+        return;
+    }
 
-    if (px4_vehicle.payload_pitch > 0) {px4_vehicle.payload_pitch = 0;}
-    if (px4_vehicle.payload_pitch < -90) {px4_vehicle.payload_pitch = -90;}
-    if (px4_vehicle.payload_yaw > 180) {px4_vehicle.payload_yaw -= 360;}
-    if (px4_vehicle.payload_yaw < -180) {px4_vehicle.payload_yaw += 360;}
+    px4_vehicle.Update_payload_attitude(pitch, yaw);
 
-    auto cmd_long = mavlink::Pld_command_long::Create();
+    auto cmd_long = arena.Create<mavlink::Pld_command_long>();
     Fill_target_ids(*cmd_long);
     (*cmd_long)->command = mavlink::MAV_CMD::MAV_CMD_DO_MOUNT_CONTROL;
     (*cmd_long)->param1 = px4_vehicle.payload_pitch;
@@ -768,8 +1456,7 @@ Px4_vehicle::Vehicle_command_act::Process_direct_vehicle_control(const Property_
 //        yaw,
 //        throttle);
 
-    px4_vehicle.Set_direct_vehicle_control(pitch * 1000, roll * 1000, throttle * 1000, yaw * 1000);
-    px4_vehicle.direct_vehicle_control_last_received = std::chrono::steady_clock::now();
+    px4_vehicle.On_direct_vehicle_control(pitch * 1000, roll * 1000, throttle * 1000, yaw * 1000);
 }
 
 bool
@@ -782,10 +1469,23 @@ Px4_vehicle::Vehicle_command_act::Try()
     }
 
     if (cmd_messages.size()) {
-        auto cmd = cmd_messages.front();
-        Send_message(*(cmd_messages.front()));
+        if (sent) {
+            px4_vehicle.Report_link_error();
+        }
+        sent = true;
+        if (!in_flight) {
+            Send_next_group();
+            return false;
+        }
+        // Resend messages of the current group still waiting for response.
+        retransmitted = true;
+        px4_vehicle.command_rtt.Backoff();
+        Update_timeout();
+        for (size_t i = 0; i < in_flight; i++) {
+            Send_message(*cmd_messages[i]);
+            VEHICLE_LOG_DBG(vehicle, "Sending to vehicle: %s", (*cmd_messages[i]).Dump().c_str());
+        }
         Schedule_timer();
-        VEHICLE_LOG_DBG(vehicle, "Sending to vehicle: %s", (*(cmd_messages.front())).Dump().c_str());
     } else {
         // Command list is empty, nothing to do.
         Disable("Command list empty");
@@ -793,16 +1493,101 @@ Px4_vehicle::Vehicle_command_act::Try()
     return false;
 }
 
+bool
+Px4_vehicle::Vehicle_command_act::Is_independent(const mavlink::Payload_base::Ptr& cmd)
+{
+    switch (cmd->Get_id()) {
+    case mavlink::MESSAGE_ID::PARAM_SET:
+    case mavlink::MESSAGE_ID::PARAM_REQUEST_READ:
+        return true;
+    case mavlink::MESSAGE_ID::COMMAND_LONG:
+        // Gimbal is controlled regardless of the vehicle mode.
+        return (*std::static_pointer_cast<mavlink::Pld_command_long>(cmd))->command.Get() ==
+            mavlink::MAV_CMD::MAV_CMD_DO_MOUNT_CONTROL;
+    default:
+        return false;
+    }
+}
+
+int
+Px4_vehicle::Vehicle_command_act::Get_ack_command_id(const mavlink::Payload_base::Ptr& cmd)
+{
+    int command_id = cmd->Get_id();
+    if (command_id == mavlink::MESSAGE_ID::COMMAND_LONG) {
+        command_id = (*std::static_pointer_cast<mavlink::Pld_command_long>(cmd))->command.Get();
+    }
+    return command_id;
+}
+
+std::string
+Px4_vehicle::Vehicle_command_act::Get_param_name(const mavlink::Payload_base::Ptr& cmd)
+{
+    switch (cmd->Get_id()) {
+    case mavlink::MESSAGE_ID::PARAM_SET:
+        return (*std::static_pointer_cast<mavlink::Pld_param_set>(cmd))->param_id.Get_string();
+    case mavlink::MESSAGE_ID::PARAM_REQUEST_READ:
+        return (*std::static_pointer_cast<mavlink::Pld_param_request_read>(cmd))->param_id.Get_string();
+    default:
+        return std::string();
+    }
+}
+
 void
-Px4_vehicle::Vehicle_command_act::Send_next_command()
+Px4_vehicle::Vehicle_command_act::Send_next_group()
 {
-    cmd_messages.pop_front();
+    // First message waits for all preceding ones. Following independent
+    // messages go together with it. Responses must stay unambiguous, so
+    // the group ends at a repeated command or parameter.
+    in_flight = 1;
+    while (in_flight < cmd_messages.size() && Is_independent(cmd_messages[in_flight])) {
+        auto& next = cmd_messages[in_flight];
+        auto command_id = Get_ack_command_id(next);
+        auto param_name = Get_param_name(next);
+        bool ambiguous = false;
+        for (size_t i = 0; i < in_flight; i++) {
+            if (param_name.size()) {
+                ambiguous = ambiguous || Get_param_name(cmd_messages[i]) == param_name;
+            } else {
+                ambiguous = ambiguous || Get_ack_command_id(cmd_messages[i]) == command_id;
+            }
+        }
+        if (ambiguous) {
+            break;
+        }
+        in_flight++;
+    }
+    for (size_t i = 0; i < in_flight; i++) {
+        Send_message(*cmd_messages[i]);
+        VEHICLE_LOG_DBG(vehicle, "Sending to vehicle: %s", (*cmd_messages[i]).Dump().c_str());
+    }
+    group_sent_at = std::chrono::steady_clock::now();
+    retransmitted = false;
+    Update_timeout();
+    Schedule_timer();
+}
+
+void
+Px4_vehicle::Vehicle_command_act::Complete_command(size_t index)
+{
+    if (!retransmitted && !extended) {
+        // Karn's algorithm, only unambiguous responses are sampled.
+        auto& rtt = px4_vehicle.command_rtt;
+        rtt.Add_sample(std::chrono::steady_clock::now() - group_sent_at);
+        VEHICLE_LOG_DBG(vehicle, "Command RTT %.0f ms, variation %.0f ms, timeout %d ms",
+            rtt.Get_srtt(), rtt.Get_rttvar(),
+            static_cast<int>(rtt.Get_timeout(retry_timeout).count()));
+    }
+    cmd_messages.erase(cmd_messages.begin() + index);
+    if (--in_flight) {
+        // Waiting for the rest of the group. Progress made, reset retries.
+        remaining_attempts = try_count;
+        return;
+    }
     if (cmd_messages.size()) {
         // send next command in chain.
         remaining_attempts = try_count;
-        Send_message(*(cmd_messages.front()));
-        Schedule_timer();
-        VEHICLE_LOG_DBG(vehicle, "Sending to vehicle: %s", (*(cmd_messages.front())).Dump().c_str());
+        sent = true;
+        Send_next_group();
     } else {
         // command chain succeeded.
         Disable_success();
@@ -813,13 +1598,14 @@ void
 Px4_vehicle::Vehicle_command_act::On_mission_current(
     mavlink::Message<mavlink::MESSAGE_ID::MISSION_CURRENT>::Ptr message)
 {
-    if (cmd_messages.size()) {
-        // we are waiting for response.
-        auto cmd = cmd_messages.front();
+    // we are waiting for response.
+    for (size_t i = 0; i < in_flight; i++) {
+        auto cmd = cmd_messages[i];
         if (    cmd->Get_id() == mavlink::MESSAGE_ID::MISSION_SET_CURRENT
             &&  message->payload->seq == (*std::static_pointer_cast<mavlink::Pld_mission_set_current>(cmd))->seq)
         {
-            Send_next_command();
+            Complete_command(i);
+            return;
         }
     }
 }
@@ -831,17 +1617,12 @@ Px4_vehicle::Vehicle_command_act::On_command_ack(
     VEHICLE_LOG_DBG(vehicle, "COMMAND_ACK for command %d, res=%d",
             message->payload->command.Get(), message->payload->result.Get());
 
-    if (cmd_messages.size()) {
-        // we are waiting for response.
-        auto cmd = cmd_messages.front();
-        int command_id = cmd->Get_id();
-        if (command_id == mavlink::MESSAGE_ID::COMMAND_LONG) {
-            command_id = (*std::static_pointer_cast<mavlink::Pld_command_long>(cmd))->command.Get();
-        }
-        if (message->payload->command.Get() == command_id) {
+    // we are waiting for response.
+    for (size_t i = 0; i < in_flight; i++) {
+        if (message->payload->command.Get() == Get_ack_command_id(cmd_messages[i])) {
             // This is a response to our command.
             if (message->payload->result == mavlink::MAV_RESULT::MAV_RESULT_ACCEPTED) {
-                Send_next_command();
+                Complete_command(i);
             } else if (px4_vehicle.vendor == Px4_vendor::YUNEEC
                        && message->payload->command.Get() == mavlink::MAV_CMD_SET_CAMERA_MODE
                        && message->payload->result == mavlink::MAV_RESULT::MAV_RESULT_IN_PROGRESS) {
@@ -855,6 +1636,7 @@ Px4_vehicle::Vehicle_command_act::On_command_ack(
                 auto p = message->payload->result.Get();
                 Disable("Result: " + std::to_string(p) + " (" + Mav_result_to_string(p).c_str() + ")");
             }
+            return;
         }
     }
 }
@@ -866,9 +1648,10 @@ Px4_vehicle::Vehicle_command_act::On_mission_ack(
     VEHICLE_LOG_INF(vehicle, "MISSION_ACK, result %d",
             message->payload->type.Get());
 
-    if (cmd_messages.size()) {
+    if (in_flight) {
         if (message->payload->type == mavlink::MAV_MISSION_RESULT::MAV_MISSION_ACCEPTED) {
-            Send_next_command();
+            // Mission messages are never grouped, it is the first one.
+            Complete_command(0);
         } else {
             auto p = message->payload->type.Get();
             Disable("MISSION_ACK result: " + std::to_string(p) + " (" + Mav_mission_result_to_string(p).c_str() + ")");
@@ -882,29 +1665,22 @@ Px4_vehicle::Vehicle_command_act::On_param_value(
 {
     VEHICLE_LOG_INF(vehicle, "PARAM_VALUE, %s", message->payload.Dump().c_str());
 
-    if (cmd_messages.size()) {
-        std::string param_name;
-        // we are waiting for response.
-        auto cmd = cmd_messages.front();
-        switch (cmd->Get_id()) {
-        case mavlink::MESSAGE_ID::PARAM_REQUEST_READ:
-            param_name = (*std::static_pointer_cast<mavlink::Pld_param_request_read>(cmd))->param_id.Get_string();
-            if (message->payload->param_id.Get_string() == param_name) {
-                Send_next_command();
-            }
-            break;
-        case mavlink::MESSAGE_ID::PARAM_SET:
-            param_name = (*std::static_pointer_cast<mavlink::Pld_param_set>(cmd))->param_id.Get_string();
-            if (message->payload->param_id.Get_string() == param_name) {
-                auto param_value = (*std::static_pointer_cast<mavlink::Pld_param_set>(cmd))->param_value.Get();
-                if (message->payload->param_value.Get() == param_value) {
-                    Send_next_command();
-                } else {
-                    Disable("PARAM_SET failed");
-                }
+    // we are waiting for response.
+    auto name = message->payload->param_id.Get_string();
+    for (size_t i = 0; i < in_flight; i++) {
+        auto cmd = cmd_messages[i];
+        if (Get_param_name(cmd) != name) {
+            continue;
+        }
+        if (cmd->Get_id() == mavlink::MESSAGE_ID::PARAM_SET) {
+            auto param_value = (*std::static_pointer_cast<mavlink::Pld_param_set>(cmd))->param_value.Get();
+            if (message->payload->param_value.Get() != param_value) {
+                Disable("PARAM_SET failed");
+                return;
             }
-            break;
         }
+        Complete_command(i);
+        return;
     }
 }
 
@@ -913,6 +1689,7 @@ Px4_vehicle::Vehicle_command_act::On_status_text(
         mavlink::Message<mavlink::MESSAGE_ID::STATUSTEXT>::Ptr)
 {
     /* Assumed command execution started, so wait longer. */
+    extended = true;
     if (current_timeout < extended_retry_timeout) {
         current_timeout = extended_retry_timeout;
         VEHICLE_LOG_DBG(vehicle, "Command execution detected, "
@@ -946,7 +1723,11 @@ Px4_vehicle::Vehicle_command_act::Enable()
         Mavlink_demuxer::COMPONENT_ID_ANY);
 
     remaining_attempts = try_count;
-    current_timeout = retry_timeout;
+    sent = false;
+    in_flight = 0;
+    retransmitted = false;
+    extended = false;
+    Update_timeout();
 
     cmd_messages.clear();
 
@@ -1001,42 +1782,505 @@ Px4_vehicle::Vehicle_command_act::Enable()
 }
 
 void
-Px4_vehicle::Vehicle_command_act::On_disable()
+Px4_vehicle::Vehicle_command_act::On_disable()
+{
+    Unregister_status_text();
+
+    timer.Cancel();
+    arena.Release();
+}
+
+void
+Px4_vehicle::Vehicle_command_act::Schedule_timer()
+{
+    px4_vehicle.Get_timer_wheel().Arm(timer, current_timeout);
+}
+
+void
+Px4_vehicle::Vehicle_command_act::Update_timeout()
+{
+    // Configured command timeout is used until the first RTT sample.
+    current_timeout = px4_vehicle.command_rtt.Get_timeout(retry_timeout);
+    if (extended && current_timeout < extended_retry_timeout) {
+        current_timeout = extended_retry_timeout;
+    }
+}
+
+void // ?
+Px4_vehicle::Vehicle_command_act::Register_status_text()
+{
+    vehicle.statistics.statustext_handler =
+            Mavlink_vehicle::Statistics::Make_statustext_handler(
+                    &Px4_vehicle::Vehicle_command_act::On_status_text,
+                    this);
+}
+
+void // ?
+Px4_vehicle::Vehicle_command_act::Unregister_status_text()
+{
+    vehicle.statistics.statustext_handler =
+            Mavlink_vehicle::Statistics::Statustext_handler();
+}
+
+void
+Px4_vehicle::Mission_write::Enable()
+{
+    full = true;
+    ranges.clear();
+    if (items.size()) {
+        ranges.push_back({0, items.size() - 1});
+    }
+    Start();
+}
+
+void
+Px4_vehicle::Mission_write::Enable(std::vector<Range> ranges, size_t current_seq)
+{
+    full = false;
+    this->ranges = std::move(ranges);
+    this->current_seq = current_seq;
+    Start();
+}
+
+void
+Px4_vehicle::Mission_write::Start()
+{
+    Register_mavlink_handler<mavlink::MESSAGE_ID::MISSION_REQUEST>(
+        &Mission_write::On_mission_request,
+        this,
+        Mavlink_demuxer::COMPONENT_ID_ANY);
+
+    Register_mavlink_handler<mavlink::MESSAGE_ID::MISSION_REQUEST_INT>(
+        &Mission_write::On_mission_request_int,
+        this,
+        Mavlink_demuxer::COMPONENT_ID_ANY);
+
+    Register_mavlink_handler<mavlink::MESSAGE_ID::MISSION_ACK>(
+        &Mission_write::On_mission_ack,
+        this,
+        Mavlink_demuxer::COMPONENT_ID_ANY);
+
+    Register_mavlink_handler<mavlink::MESSAGE_ID::MISSION_CURRENT>(
+        &Mission_write::On_mission_current,
+        this,
+        Mavlink_demuxer::COMPONENT_ID_ANY);
+
+    current_range = 0;
+    rejected = false;
+    setting_current = false;
+    if (ranges.empty() && !full) {
+        // Nothing changed, only restart the mission.
+        Start_set_current();
+    } else {
+        Start_range();
+    }
+}
+
+void
+Px4_vehicle::Mission_write::On_disable()
+{
+    timer.Cancel();
+    items.clear();
+    ranges.clear();
+    last_requested.Disengage();
+}
+
+void
+Px4_vehicle::Mission_write::Start_range()
+{
+    last_requested.Disengage();
+    remaining_attempts = try_count;
+    Send_list();
+    Schedule_timer();
+    if (full) {
+        VEHICLE_LOG_DBG(vehicle, "Uploading %zu mission items", items.size());
+    } else {
+        VEHICLE_LOG_DBG(vehicle, "Writing mission items %zu..%zu",
+            ranges[current_range].first, ranges[current_range].last);
+    }
+}
+
+void
+Px4_vehicle::Mission_write::Start_set_current()
+{
+    setting_current = true;
+    remaining_attempts = try_count;
+    Send_set_current();
+    Schedule_timer();
+}
+
+void
+Px4_vehicle::Mission_write::Send_set_current()
+{
+    auto set_current = mavlink::Pld_mission_set_current::Create();
+    Fill_target_ids(*set_current);
+    (*set_current)->seq = current_seq;
+    Send_message(*set_current);
+}
+
+void
+Px4_vehicle::Mission_write::Send_list()
+{
+    if (full) {
+        auto count = mavlink::Pld_mission_count::Create();
+        Fill_target_ids(*count);
+        (*count)->count = items.size();
+        Send_message(*count);
+    } else {
+        auto& range = ranges[current_range];
+        auto partial_list = mavlink::Pld_mission_write_partial_list::Create();
+        Fill_target_ids(*partial_list);
+        (*partial_list)->start_index = range.first;
+        (*partial_list)->end_index = range.last;
+        Send_message(*partial_list);
+    }
+}
+
+bool
+Px4_vehicle::Mission_write::Try()
+{
+    if (!remaining_attempts--) {
+        if (setting_current) {
+            Disable("Mission set current timed out");
+            return false;
+        }
+        // No request for the first item means the vehicle ignores partial writes.
+        rejected = !full && !last_requested && current_range == 0;
+        Disable("Mission write timed out");
+        return false;
+    }
+    px4_vehicle.Report_link_error();
+    if (setting_current) {
+        Send_set_current();
+    } else if (last_requested) {
+        Send_message(*items[*last_requested]);
+    } else {
+        Send_list();
+    }
+    Schedule_timer();
+    return false;
+}
+
+void
+Px4_vehicle::Mission_write::Schedule_timer()
+{
+    px4_vehicle.Get_timer_wheel().Arm(timer, retry_timeout);
+}
+
+void
+Px4_vehicle::Mission_write::On_item_requested(size_t seq)
+{
+    if (setting_current || ranges.empty()) {
+        return;
+    }
+    auto& range = ranges[current_range];
+    if (seq < range.first || seq > range.last) {
+        VEHICLE_LOG_WRN(vehicle, "Item %zu requested outside of written range %zu..%zu, ignored.",
+            seq, range.first, range.last);
+        return;
+    }
+    if (!last_requested || *last_requested != seq) {
+        // Progress made, reset retries.
+        remaining_attempts = try_count;
+    }
+    last_requested = seq;
+    Send_message(*items[seq]);
+    Schedule_timer();
+}
+
+void
+Px4_vehicle::Mission_write::On_mission_request(
+    mavlink::Message<mavlink::MESSAGE_ID::MISSION_REQUEST>::Ptr message)
+{
+    On_item_requested(message->payload->seq.Get());
+}
+
+void
+Px4_vehicle::Mission_write::On_mission_request_int(
+    mavlink::Message<mavlink::MESSAGE_ID::MISSION_REQUEST_INT>::Ptr message)
+{
+    On_item_requested(message->payload->seq.Get());
+}
+
+void
+Px4_vehicle::Mission_write::On_mission_ack(
+    mavlink::Message<mavlink::MESSAGE_ID::MISSION_ACK>::Ptr message)
+{
+    if (setting_current) {
+        return;
+    }
+    auto result = message->payload->type.Get();
+    if (result != mavlink::MAV_MISSION_RESULT::MAV_MISSION_ACCEPTED) {
+        // Refusal of the first range only, later ranges prove support.
+        rejected = !full && !last_requested && current_range == 0;
+        Disable("MISSION_ACK result: " + std::to_string(result) +
+            " (" + Mav_mission_result_to_string(result).c_str() + ")");
+        return;
+    }
+    if (ranges.empty()) {
+        // Empty mission accepted.
+        Disable_success();
+        return;
+    }
+    if (!last_requested || *last_requested != ranges[current_range].last) {
+        // Stale ack from previous transfer.
+        return;
+    }
+    if (++current_range < ranges.size()) {
+        Start_range();
+    } else if (!full) {
+        // Full upload restarts the mission, do the same for the partial one.
+        Start_set_current();
+    } else {
+        Disable_success();
+    }
+}
+
+void
+Px4_vehicle::Mission_write::On_mission_current(
+    mavlink::Message<mavlink::MESSAGE_ID::MISSION_CURRENT>::Ptr message)
+{
+    if (setting_current && message->payload->seq.Get() == current_seq) {
+        Disable_success();
+    }
+}
+
+void
+Px4_vehicle::Telemetry_setup::Enable()
+{
+    Register_mavlink_handler<mavlink::MESSAGE_ID::MESSAGE_INTERVAL>(
+        &Telemetry_setup::On_message_interval,
+        this,
+        Mavlink_demuxer::COMPONENT_ID_ANY);
+
+    streams.clear();
+    px4_vehicle.effective_telemetry_rates.clear();
+    for (auto& it : px4_vehicle.telemetry_rates) {
+        streams[it.first].requested_rate = px4_vehicle.Get_telemetry_rate(it.first);
+        Send_set_interval(it.first);
+        Send_get_interval(it.first);
+    }
+    remaining_attempts = try_count;
+    Schedule_timer();
+}
+
+void
+Px4_vehicle::Telemetry_setup::On_disable()
+{
+    timer.Cancel();
+    streams.clear();
+}
+
+bool
+Px4_vehicle::Telemetry_setup::Try()
+{
+    if (!remaining_attempts--) {
+        Complete();
+        return false;
+    }
+    px4_vehicle.Report_link_error();
+    for (auto& it : streams) {
+        if (it.second.applied_rate) {
+            continue;
+        }
+        Send_set_interval(it.first);
+        Send_get_interval(it.first);
+    }
+    Schedule_timer();
+    return false;
+}
+
+void
+Px4_vehicle::Telemetry_setup::Schedule_timer()
+{
+    px4_vehicle.Get_timer_wheel().Arm(timer, retry_timeout);
+}
+
+void
+Px4_vehicle::Telemetry_setup::Send_set_interval(int message_id)
+{
+    auto cmd_long = mavlink::Pld_command_long::Create();
+    Fill_target_ids(*cmd_long);
+    (*cmd_long)->command = mavlink::MAV_CMD::MAV_CMD_SET_MESSAGE_INTERVAL;
+    (*cmd_long)->param1 = message_id;
+    (*cmd_long)->param2 = 1000000.0 / streams[message_id].requested_rate;
+    Send_message(*cmd_long);
+}
+
+void
+Px4_vehicle::Telemetry_setup::Send_get_interval(int message_id)
+{
+    auto cmd_long = mavlink::Pld_command_long::Create();
+    Fill_target_ids(*cmd_long);
+    (*cmd_long)->command = mavlink::MAV_CMD::MAV_CMD_GET_MESSAGE_INTERVAL;
+    (*cmd_long)->param1 = message_id;
+    Send_message(*cmd_long);
+}
+
+void
+Px4_vehicle::Telemetry_setup::On_message_interval(
+    mavlink::Message<mavlink::MESSAGE_ID::MESSAGE_INTERVAL>::Ptr message)
+{
+    auto it = streams.find(message->payload->message_id.Get());
+    if (it == streams.end()) {
+        return;
+    }
+    auto& stream = it->second;
+    auto interval = message->payload->interval_us.Get();
+    // Zero means default rate which is unknown here, -1 means stream is off.
+    float rate = interval > 0 ? 1000000.0 / interval : 0;
+    stream.reported_rate = rate;
+    if (fabs(rate - stream.requested_rate) > stream.requested_rate * TELEMETRY_RATE_TOLERANCE) {
+        VEHICLE_LOG_DBG(vehicle, "Message %d rate %0.2f Hz differs from requested %0.2f Hz.",
+            it->first, rate, stream.requested_rate);
+        // Rate not applied, setting it again on retry.
+        return;
+    }
+    stream.applied_rate = rate;
+    for (auto& s : streams) {
+        if (!s.second.applied_rate) {
+            return;
+        }
+    }
+    Complete();
+}
+
+void
+Px4_vehicle::Telemetry_setup::Complete()
+{
+    auto& effective_rates = px4_vehicle.effective_telemetry_rates;
+    effective_rates.clear();
+    for (auto& it : streams) {
+        auto& stream = it.second;
+        if (stream.applied_rate) {
+            effective_rates[it.first] = *stream.applied_rate;
+            VEHICLE_LOG_INF(vehicle, "Message %d rate set to %0.2f Hz.",
+                it.first, *stream.applied_rate);
+        } else if (stream.reported_rate) {
+            // Zero for streams the vehicle does not support.
+            effective_rates[it.first] = *stream.reported_rate;
+            VEHICLE_LOG_WRN(vehicle, "Message %d rate is %0.2f Hz instead of requested %0.2f Hz.",
+                it.first, *stream.reported_rate, stream.requested_rate);
+        } else {
+            VEHICLE_LOG_WRN(vehicle, "Failed to set message %d rate to %0.2f Hz.",
+                it.first, stream.requested_rate);
+        }
+    }
+    px4_vehicle.Update_expected_telemetry_rate();
+    Disable_success();
+}
+
+void
+Px4_vehicle::Mission_cache_check::Enable(std::vector<uint32_t> hashes)
+{
+    Register_mavlink_handler<mavlink::MESSAGE_ID::MISSION_COUNT>(
+        &Mission_cache_check::On_mission_count,
+        this,
+        Mavlink_demuxer::COMPONENT_ID_ANY);
+
+    Register_mavlink_handler<mavlink::MESSAGE_ID::MISSION_ITEM>(
+        &Mission_cache_check::On_mission_item,
+        this,
+        Mavlink_demuxer::COMPONENT_ID_ANY);
+
+    this->hashes = std::move(hashes);
+    samples.clear();
+    current_sample = 0;
+    remaining_attempts = try_count;
+    Try();
+}
+
+void
+Px4_vehicle::Mission_cache_check::On_disable()
 {
-    Unregister_status_text();
+    timer.Cancel();
+    hashes.clear();
+    samples.clear();
+}
 
-    if (timer) {
-        timer->Cancel();
-        timer = nullptr;
+bool
+Px4_vehicle::Mission_cache_check::Try()
+{
+    if (!remaining_attempts--) {
+        VEHICLE_LOG_WRN(vehicle, "Mission cache check timed out, downloading mission.");
+        Disable();
+        px4_vehicle.Download_mission();
+        return false;
+    }
+    if (samples.empty()) {
+        auto request_list = mavlink::Pld_mission_request_list::Create();
+        Fill_target_ids(*request_list);
+        Send_message(*request_list);
+    } else {
+        auto request = mavlink::Pld_mission_request::Create();
+        Fill_target_ids(*request);
+        (*request)->seq = samples[current_sample];
+        Send_message(*request);
     }
+    Schedule_timer();
+    return false;
 }
 
 void
-Px4_vehicle::Vehicle_command_act::Schedule_timer()
+Px4_vehicle::Mission_cache_check::Schedule_timer()
 {
-    if (timer) {
-        timer->Cancel();
-    }
-    timer = Timer_processor::Get_instance()->Create_timer(
-                current_timeout,
-                Make_callback(&Vehicle_command_act::Try, this),
-                vehicle.Get_completion_ctx());
+    px4_vehicle.Get_timer_wheel().Arm(timer, retry_timeout);
 }
 
-void // ?
-Px4_vehicle::Vehicle_command_act::Register_status_text()
+void
+Px4_vehicle::Mission_cache_check::On_mission_count(
+    mavlink::Message<mavlink::MESSAGE_ID::MISSION_COUNT>::Ptr message)
 {
-    vehicle.statistics.statustext_handler =
-            Mavlink_vehicle::Statistics::Make_statustext_handler(
-                    &Px4_vehicle::Vehicle_command_act::On_status_text,
-                    this);
+    if (!samples.empty()) {
+        return;
+    }
+    size_t count = message->payload->count.Get();
+    if (count != hashes.size()) {
+        VEHICLE_LOG_INF(vehicle, "Vehicle has %zu mission items, cache has %zu, downloading mission.",
+            count, hashes.size());
+        Disable();
+        px4_vehicle.Download_mission();
+        return;
+    }
+    // Same count proves nothing, compare the first, the last and evenly
+    // spaced items in between.
+    size_t sample_count = count < SAMPLE_COUNT ? count : SAMPLE_COUNT;
+    for (size_t i = 0; i < sample_count; i++) {
+        samples.push_back(sample_count > 1 ? i * (count - 1) / (sample_count - 1) : 0);
+    }
+    timer.Cancel();
+    remaining_attempts = try_count;
+    Try();
 }
 
-void // ?
-Px4_vehicle::Vehicle_command_act::Unregister_status_text()
+void
+Px4_vehicle::Mission_cache_check::On_mission_item(
+    mavlink::Message<mavlink::MESSAGE_ID::MISSION_ITEM>::Ptr message)
 {
-    vehicle.statistics.statustext_handler =
-            Mavlink_vehicle::Statistics::Statustext_handler();
+    if (samples.empty() || message->payload->seq.Get() != samples[current_sample]) {
+        return;
+    }
+    bool matches = Get_mission_item_hash(message->payload) == hashes[samples[current_sample]];
+    if (matches && ++current_sample < samples.size()) {
+        timer.Cancel();
+        remaining_attempts = try_count;
+        Try();
+        return;
+    }
+    // Vehicle waits for more item requests, tell it the transfer is over.
+    auto ack = mavlink::Pld_mission_ack::Create();
+    Fill_target_ids(*ack);
+    (*ack)->type = mavlink::MAV_MISSION_RESULT::MAV_MISSION_ACCEPTED;
+    Send_message(*ack);
+    auto cached = std::move(hashes);
+    Disable();
+    if (matches) {
+        px4_vehicle.Restore_cached_mission(std::move(cached));
+    } else {
+        VEHICLE_LOG_INF(vehicle, "Mission item %zu differs from the cache, downloading mission.",
+            static_cast<size_t>(message->payload->seq.Get()));
+        px4_vehicle.Download_mission();
+    }
 }
 
 void
@@ -1044,6 +2288,8 @@ Px4_vehicle::Task_upload::Enable(Vehicle_task_request::Handle request)
 {
     // Clean state.
     prepared_actions.clear();
+    prepared_info.clear();
+    pending_position.Disengage();
     task_attributes.clear();
     current_mission_poi.Disengage();
     current_mission_heading.Disengage();
@@ -1094,6 +2340,9 @@ Px4_vehicle::Task_upload::Enable(Vehicle_task_request::Handle request)
     this->request = request;
 
     Filter_actions();
+    if (px4_vehicle.route_simplification_tolerance > 0) {
+        Simplify_route();
+    }
 
     if (max_mission_speed > MAX_COPTER_SPEED) {
         VEHICLE_LOG_WRN(vehicle, "Max speed used in mission %f exceeds the max allowed %f m/s.",
@@ -1104,14 +2353,21 @@ Px4_vehicle::Task_upload::Enable(Vehicle_task_request::Handle request)
 
     if (request->return_native_route) {
         Prepare_task();
-        std::string mission = Generate_wpl(prepared_actions, request->use_crlf_in_native_route);
-        request->ucs_response->mutable_device_response()->set_status(mission);
+        request->ucs_response->mutable_device_response()->set_status(
+            Export_native_route(request->use_crlf_in_native_route));
         request.Succeed();
         Disable();
         return;
     }
 
     Prepare_task_attributes();
+    px4_vehicle.Filter_cached_parameters(task_attributes);
+
+    if (task_attributes.empty()) {
+        // Nothing to write, save the round trips.
+        Task_atributes_uploaded(true, std::string());
+        return;
+    }
 
     vehicle.write_parameters.Disable();
     vehicle.write_parameters.Set_next_action(
@@ -1135,19 +2391,211 @@ Px4_vehicle::Task_upload::Task_atributes_uploaded(bool success, std::string erro
     }
 
     Prepare_task();
-    vehicle.mission_upload.Disable();
-    vehicle.mission_upload.mission_items = std::move(prepared_actions);
-    vehicle.mission_upload.Set_next_action(
+    Dump_mission();
+    Upload_mission();
+}
+
+void
+Px4_vehicle::Task_upload::Upload_mission()
+{
+    auto& uploaded = px4_vehicle.uploaded_mission;
+    if (    px4_vehicle.partial_mission_write_supported
+        &&  uploaded.size()
+        &&  uploaded.size() == prepared_info.size())
+    {
+        auto ranges = Get_changed_ranges();
+        size_t changed = 0;
+        for (auto& r : ranges) {
+            changed += r.last - r.first + 1;
+        }
+        // Full upload is cheaper when most of the route has changed.
+        if (changed * 2 <= prepared_info.size()) {
+            if (ranges.empty()) {
+                VEHICLE_LOG_INF(vehicle, "Route is the same as on the vehicle, only restarting it.");
+            } else {
+                VEHICLE_LOG_INF(vehicle, "Writing %zu of %zu mission items in %zu ranges.",
+                    changed, prepared_info.size(), ranges.size());
+            }
+            size_t current_seq = 0;
+            size_t seq = 0;
+            for (auto& item : prepared_actions) {
+                auto mi = std::static_pointer_cast<mavlink::Pld_mission_item>(item);
+                if ((*mi)->current.Get()) {
+                    current_seq = seq;
+                    break;
+                }
+                seq++;
+            }
+            px4_vehicle.mission_write.Disable();
+            Fill_mission_write_items();
+            px4_vehicle.mission_write.Set_next_action(
+                    Activity::Make_next_action(
+                            &Task_upload::Partial_mission_uploaded,
+                            this));
+            px4_vehicle.mission_write.Enable(std::move(ranges), current_seq);
+            return;
+        }
+    }
+    Upload_full_mission();
+}
+
+void
+Px4_vehicle::Task_upload::Upload_full_mission()
+{
+    px4_vehicle.mission_write.Disable();
+    Fill_mission_write_items();
+    px4_vehicle.mission_write.Set_next_action(
             Activity::Make_next_action(
                     &Task_upload::Mission_uploaded,
                     this));
-    vehicle.mission_upload.Enable();
+    px4_vehicle.mission_write.Enable();
+}
+
+void
+Px4_vehicle::Task_upload::Fill_mission_write_items()
+{
+    auto& items = px4_vehicle.mission_write.items;
+    items.clear();
+    items.reserve(prepared_actions.size());
+    size_t seq = 0;
+    for (auto& item : prepared_actions) {
+        if (px4_vehicle.mission_item_int_supported) {
+            items.push_back(Build_mission_item_int(
+                *std::static_pointer_cast<mavlink::Pld_mission_item>(item),
+                prepared_info[seq]));
+        } else {
+            items.push_back(item);
+        }
+        seq++;
+    }
+}
+
+mavlink::Pld_mission_item_int::Ptr
+Px4_vehicle::Task_upload::Build_mission_item_int(
+    mavlink::Pld_mission_item& mi,
+    const Item_info& info)
+{
+    auto mi_int = arena.Create<mavlink::Pld_mission_item_int>();
+    (*mi_int)->target_system = mi->target_system.Get();
+    (*mi_int)->target_component = mi->target_component.Get();
+    (*mi_int)->seq = mi->seq.Get();
+    (*mi_int)->frame = mi->frame.Get();
+    (*mi_int)->command = mi->command.Get();
+    (*mi_int)->current = mi->current.Get();
+    (*mi_int)->autocontinue = mi->autocontinue.Get();
+    (*mi_int)->param1 = mi->param1.Get();
+    (*mi_int)->param2 = mi->param2.Get();
+    (*mi_int)->param3 = mi->param3.Get();
+    (*mi_int)->param4 = mi->param4.Get();
+    if (info.has_position) {
+        (*mi_int)->x = info.latitude;
+        (*mi_int)->y = info.longitude;
+    } else {
+        // x and y are plain integer params 5 and 6 for non-positional items.
+        (*mi_int)->x = static_cast<int32_t>(std::lround(mi->x.Get()));
+        (*mi_int)->y = static_cast<int32_t>(std::lround(mi->y.Get()));
+    }
+    (*mi_int)->z = mi->z.Get();
+    return mi_int;
+}
+
+void
+Px4_vehicle::Task_upload::Dump_mission()
+{
+    if (!vehicle.mission_dump_path) {
+        return;
+    }
+    char timestamp[32];
+    auto now = std::time(nullptr);
+    std::strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", std::localtime(&now));
+    auto file_name = *vehicle.mission_dump_path + "-" + timestamp;
+    // Payloads stay in the vehicle context, the writer gets plain copies.
+    std::vector<Wpl_item> items;
+    items.reserve(prepared_actions.size());
+    for (auto& action : prepared_actions) {
+        items.push_back(Make_wpl_item(*std::static_pointer_cast<mavlink::Pld_mission_item>(action)));
+    }
+    auto& writer = px4_vehicle.Get_mission_dump_writer();
+    if (!writer.Write(file_name, std::move(items), px4_vehicle.mission_dump_formats)) {
+        VEHICLE_LOG_WRN(vehicle, "Mission dump %s dropped, writer is busy (%zu dropped in total).",
+            file_name.c_str(),
+            writer.Get_dropped());
+    }
+}
+
+std::string
+Px4_vehicle::Task_upload::Export_native_route(bool crlf)
+{
+    // Items are formatted one by one straight into the result, which is
+    // then moved into the response.
+    std::string route;
+    Wpl_writer writer(route, crlf, prepared_actions.size());
+    for (auto& action : prepared_actions) {
+        writer.Write(Make_wpl_item(*std::static_pointer_cast<mavlink::Pld_mission_item>(action)));
+    }
+    return route;
+}
+
+Wpl_item
+Px4_vehicle::Task_upload::Make_wpl_item(mavlink::Pld_mission_item& mi)
+{
+    Wpl_item item;
+    item.param1 = mi->param1.Get();
+    item.param2 = mi->param2.Get();
+    item.param3 = mi->param3.Get();
+    item.param4 = mi->param4.Get();
+    item.x = mi->x.Get();
+    item.y = mi->y.Get();
+    item.z = mi->z.Get();
+    item.seq = mi->seq.Get();
+    item.command = mi->command.Get();
+    item.frame = mi->frame.Get();
+    item.current = mi->current.Get();
+    item.autocontinue = mi->autocontinue.Get();
+    return item;
+}
+
+std::vector<Px4_vehicle::Mission_write::Range>
+Px4_vehicle::Task_upload::Get_changed_ranges()
+{
+    std::vector<Mission_write::Range> ranges;
+    auto& uploaded = px4_vehicle.uploaded_mission;
+    for (size_t seq = 0; seq < prepared_info.size(); seq++) {
+        if (prepared_info[seq].write_hash == uploaded[seq]) {
+            continue;
+        }
+        if (ranges.size() && seq - ranges.back().last <= PARTIAL_WRITE_MERGE_GAP) {
+            ranges.back().last = seq;
+        } else {
+            ranges.push_back({seq, seq});
+        }
+    }
+    return ranges;
+}
+
+void
+Px4_vehicle::Task_upload::Partial_mission_uploaded(bool success, std::string error_msg)
+{
+    if (success) {
+        Mission_uploaded(true, error_msg);
+        return;
+    }
+    if (px4_vehicle.mission_write.rejected) {
+        // Do not try again until reconnect.
+        px4_vehicle.partial_mission_write_supported = false;
+    }
+    VEHICLE_LOG_WRN(vehicle, "Partial mission write failed (%s), uploading full mission.",
+        error_msg.c_str());
+    Upload_full_mission();
 }
 
 void
 Px4_vehicle::Task_upload::Mission_uploaded(bool success, std::string error_msg)
 {
     if (!success) {
+        // Vehicle could be left with partially written mission.
+        px4_vehicle.uploaded_mission.clear();
+        px4_vehicle.Save_mission_cache({});
         if (error_msg.size()) {
             request.Fail(error_msg);
         } else {
@@ -1157,8 +2605,19 @@ Px4_vehicle::Task_upload::Mission_uploaded(bool success, std::string error_msg)
         return;
     }
 
+    // Cache keeps hashes of the items as they are downloaded, to compare
+    // them with items read back from the vehicle.
+    std::vector<uint32_t> route_hashes;
+    route_hashes.reserve(prepared_info.size());
+    px4_vehicle.uploaded_mission.clear();
+    px4_vehicle.uploaded_mission.reserve(prepared_info.size());
+    for (auto& info : prepared_info) {
+        px4_vehicle.uploaded_mission.push_back(info.write_hash);
+        route_hashes.push_back(info.hash);
+    }
 
     px4_vehicle.Calculate_current_route_id();
+    px4_vehicle.Save_mission_cache(route_hashes);
 
     LOG("Uploaded mission_id=%08X", px4_vehicle.current_route_id);
     vehicle.current_command_map.Fill_command_mapping_response(request->ucs_response);
@@ -1175,6 +2634,11 @@ Px4_vehicle::Task_upload::Fill_mavlink_mission_item_coords(
 {
     msg->x = (tuple.latitude * 180.0) / M_PI;
     msg->y = (tuple.longitude * 180.0) / M_PI;
+    // Keep exact coordinates for MISSION_ITEM_INT, float loses up to a meter.
+    // Each item is added right after it is built.
+    pending_position = std::make_pair(
+        static_cast<int32_t>(std::lround(tuple.latitude * 180.0 / M_PI * 1e7)),
+        static_cast<int32_t>(std::lround(tuple.longitude * 180.0 / M_PI * 1e7)));
     /* Fixup absolute altitude - make them relative to
      * take-off altitude.
      */
@@ -1182,6 +2646,23 @@ Px4_vehicle::Task_upload::Fill_mavlink_mission_item_coords(
     msg->param4 = (heading * 180.0) / M_PI;
 }
 
+void
+Px4_vehicle::Task_upload::Set_item_hashes(mavlink::Pld_mission_item& msg, Item_info& info)
+{
+    info.hash = Get_mission_item_hash(msg);
+    info.write_hash = info.hash;
+    if (info.has_position && px4_vehicle.mission_item_int_supported) {
+        // Float coordinates hide changes below a float step, up to half a
+        // meter, which MISSION_ITEM_INT does write. FNV-1a over the exact ones.
+        for (auto value : {info.latitude, info.longitude}) {
+            auto bits = static_cast<uint32_t>(value);
+            for (int i = 0; i < 4; i++) {
+                info.write_hash = (info.write_hash ^ ((bits >> (i * 8)) & 0xff)) * 16777619;
+            }
+        }
+    }
+}
+
 void
 Px4_vehicle::Task_upload::Fill_mavlink_mission_item_common(
         mavlink::Pld_mission_item& msg)
@@ -1191,7 +2672,17 @@ Px4_vehicle::Task_upload::Fill_mavlink_mission_item_common(
     Fill_target_ids(msg);
     msg->seq = prepared_actions.size();
 
-    vehicle.current_command_map.Accumulate_route_id(Get_mission_item_hash(msg));
+    Item_info info;
+    if (pending_position) {
+        info.has_position = true;
+        info.latitude = (*pending_position).first;
+        info.longitude = (*pending_position).second;
+        pending_position.Disengage();
+    }
+    Set_item_hashes(msg, info);
+    vehicle.current_command_map.Accumulate_route_id(info.hash);
+    info.command_id = current_command_id;
+    prepared_info.push_back(info);
     vehicle.current_command_map.Add_command_mapping(msg->seq);
 
     switch (msg->command) {
@@ -1222,9 +2713,13 @@ Px4_vehicle::Task_upload::On_disable()
 {
     request.Fail();
     vehicle.write_parameters.Disable();
-    vehicle.mission_upload.Disable();
+    px4_vehicle.mission_write.Disable();
     prepared_actions.clear();
+    prepared_info.clear();
+    pending_position.Disengage();
+    merged_commands.clear();
     task_attributes.clear();
+    arena.Release();
     current_mission_poi.Disengage();
     current_mission_heading.Disengage();
     current_camera_mode.Disengage();
@@ -1348,17 +2843,295 @@ Px4_vehicle::Task_upload::Filter_other_actions()
     }
 }
 
+void
+Px4_vehicle::Task_upload::Simplify_route()
+{
+    merged_commands.clear();
+    std::vector<Geodetic_tuple> positions;
+    std::vector<bool> anchors;
+    // Previous action is not a MOVE, or there is none.
+    bool after_other = true;
+    for (auto& action : request->actions) {
+        if (action->Get_type() != Action::Type::MOVE) {
+            if (!after_other && !anchors.empty()) {
+                // Actions are performed at the previous waypoint.
+                anchors.back() = true;
+            }
+            after_other = true;
+            continue;
+        }
+        auto move = action->Get_action<Action::Type::MOVE>();
+        positions.push_back(move->position.Get_geodetic());
+        anchors.push_back(after_other || move->wait_time != 0 || move->loiter_orbit != 0);
+        after_other = false;
+    }
+    if (positions.size() < 3) {
+        return;
+    }
+
+    // Equirectangular projection around the mean latitude is good enough
+    // for tolerances of meters on routes of tens of kilometers.
+    double mean_latitude = 0;
+    for (auto& position : positions) {
+        mean_latitude += position.latitude;
+    }
+    mean_latitude /= positions.size();
+    auto& origin = positions.front();
+    auto x_scale = EARTH_RADIUS * std::cos(mean_latitude);
+    Path_simplifier simplifier(px4_vehicle.route_simplification_tolerance);
+    for (size_t i = 0; i < positions.size(); i++) {
+        auto& position = positions[i];
+        simplifier.Add_point(
+            std::remainder(position.longitude - origin.longitude, 2 * M_PI) * x_scale,
+            (position.latitude - origin.latitude) * EARTH_RADIUS,
+            position.altitude - origin.altitude,
+            anchors[i]);
+    }
+    auto keep = simplifier.Simplify();
+
+    size_t index = 0;
+    for (auto iter = request->actions.begin(); iter != request->actions.end();) {
+        if ((*iter)->Get_type() == Action::Type::MOVE && !keep[index++]) {
+            merged_commands.push_back((*iter)->command_id);
+            iter = request->actions.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+    if (merged_commands.empty()) {
+        return;
+    }
+    std::sort(merged_commands.begin(), merged_commands.end());
+    VEHICLE_LOG_INF(vehicle, "Route simplified, %zu of %zu waypoints merged, commands %s.",
+        merged_commands.size(),
+        positions.size(),
+        Format_command_ranges(merged_commands, std::string::npos).c_str());
+    vehicle.Add_status_message(
+        "Route simplified, merged commands: " +
+        Format_command_ranges(merged_commands, MERGED_COMMANDS_STATUS_MAX));
+}
+
+std::string
+Px4_vehicle::Task_upload::Format_command_ranges(const std::vector<int>& ids, size_t max_length)
+{
+    std::string result;
+    for (size_t i = 0; i < ids.size();) {
+        auto last = i;
+        while (last + 1 < ids.size() && ids[last + 1] == ids[last] + 1) {
+            last++;
+        }
+        auto range = std::to_string(ids[i]);
+        if (last != i) {
+            range += "-" + std::to_string(ids[last]);
+        }
+        if (result.size() + range.size() + 2 > max_length) {
+            result += ", ...";
+            break;
+        }
+        if (!result.empty()) {
+            result += ", ";
+        }
+        result += range;
+        i = last + 1;
+    }
+    return result;
+}
+
 void
 Px4_vehicle::Task_upload::Prepare_task()
 {
     prepared_actions.clear();
+    prepared_info.clear();
+    pending_position.Disengage();
+    // Most actions produce one or two items.
+    arena.Reserve(request->actions.size() * 2 * ARENA_BYTES_PER_ITEM);
     vehicle.current_command_map.Reset();
     last_move_action = nullptr;
     takeoff_action = nullptr;
     for (auto& iter : request->actions) {
         vehicle.current_command_map.Set_current_command(iter->command_id);
+        current_command_id = iter->command_id;
         Prepare_action(iter);
     }
+    if (px4_vehicle.mission_compaction) {
+        Compact_mission();
+    }
+}
+
+void
+Px4_vehicle::Task_upload::Compact_mission()
+{
+    // State set by the kept items, unknown until set by the mission.
+    enum class Roi { UNKNOWN, NONE, LOCATION };
+    Roi roi = Roi::UNKNOWN;
+    size_t roi_item = 0;
+    Optional<std::tuple<float, float, float>> speed;
+    Optional<float> camera_mode;
+    Optional<float> trigger_distance;
+    Optional<bool> image_series;
+    Optional<bool> video_recording;
+
+    auto item = [this](size_t index) -> mavlink::Pld_mission_item& {
+        return *std::static_pointer_cast<mavlink::Pld_mission_item>(prepared_actions[index]);
+    };
+    auto same_position = [&](size_t a, size_t b) {
+        auto& info_a = prepared_info[a];
+        auto& info_b = prepared_info[b];
+        return info_a.has_position && info_b.has_position &&
+            info_a.latitude == info_b.latitude &&
+            info_a.longitude == info_b.longitude &&
+            item(a)->z.Get() == item(b)->z.Get();
+    };
+    auto same_heading = [](float a, float b) {
+        return a == b || (std::isnan(a) && std::isnan(b));
+    };
+    auto is_waypoint = [&](size_t index) {
+        return item(index)->command.Get() == mavlink::MAV_CMD_NAV_WAYPOINT;
+    };
+
+    auto count = prepared_actions.size();
+    // Commands of the dropped items, some may still have other items.
+    std::vector<int> dropped_commands;
+    // Kept items are moved to the front, in place.
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        auto& mi = item(i);
+        bool drop = false;
+        switch (mi->command.Get()) {
+        case mavlink::MAV_CMD_NAV_WAYPOINT:
+        {
+            if (!kept || !is_waypoint(kept - 1) || !same_position(kept - 1, i)) {
+                break;
+            }
+            auto& prev = item(kept - 1);
+            if (prev->param2.Get() != mi->param2.Get() || prev->param3.Get() != mi->param3.Get()) {
+                break;
+            }
+            if (mi->param1.Get() == 0 && !mi->current.Get() &&
+                i + 1 < count && is_waypoint(i + 1) &&
+                same_heading(mi->param4.Get(), item(i + 1)->param4.Get()))
+            {
+                // Heading waypoint, the next waypoint turns to the same
+                // heading on the way.
+                drop = true;
+            } else if (prev->param1.Get() == 0 || same_heading(prev->param4.Get(), mi->param4.Get())) {
+                // Repeated waypoint: sum the holds, keep the heading of
+                // the latter.
+                prev->param1 = prev->param1.Get() + mi->param1.Get();
+                prev->param4 = mi->param4.Get();
+                if (mi->current.Get()) {
+                    prev->current = 1;
+                }
+                drop = true;
+            }
+            break;
+        }
+        case mavlink::MAV_CMD_DO_SET_ROI_LOCATION:
+            if (roi == Roi::LOCATION && same_position(roi_item, i)) {
+                drop = true;
+            } else {
+                roi = Roi::LOCATION;
+                roi_item = i;
+            }
+            break;
+        case mavlink::MAV_CMD_DO_SET_ROI_NONE:
+            drop = roi == Roi::NONE;
+            roi = Roi::NONE;
+            break;
+        case mavlink::MAV_CMD_DO_CHANGE_SPEED:
+        {
+            auto value = std::make_tuple(mi->param1.Get(), mi->param2.Get(), mi->param3.Get());
+            drop = speed && *speed == value;
+            speed = value;
+            break;
+        }
+        case mavlink::MAV_CMD_SET_CAMERA_MODE:
+            drop = camera_mode && *camera_mode == mi->param2.Get();
+            camera_mode = mi->param2.Get();
+            break;
+        case mavlink::MAV_CMD_DO_SET_CAM_TRIGG_DIST:
+            drop = trigger_distance && *trigger_distance == mi->param1.Get();
+            trigger_distance = mi->param1.Get();
+            break;
+        case mavlink::MAV_CMD_IMAGE_START_CAPTURE:
+            if (mi->param3.Get() == 0) {
+                // Unlimited series, single photos do not change the state.
+                image_series = true;
+            }
+            break;
+        case mavlink::MAV_CMD_IMAGE_STOP_CAPTURE:
+            drop = image_series && !*image_series;
+            image_series = false;
+            break;
+        case mavlink::MAV_CMD_VIDEO_START_CAPTURE:
+            video_recording = true;
+            break;
+        case mavlink::MAV_CMD_VIDEO_STOP_CAPTURE:
+            drop = video_recording && !*video_recording;
+            video_recording = false;
+            break;
+        default:
+            break;
+        }
+        if (drop) {
+            dropped_commands.push_back(prepared_info[i].command_id);
+            continue;
+        }
+        if (is_waypoint(i) &&
+            (px4_vehicle.auto_generate_mission_poi || !std::isnan(mi->param4.Get())))
+        {
+            // Older PX4 forgets ROI on each waypoint, explicit heading
+            // overrides it.
+            roi = Roi::UNKNOWN;
+        }
+        if (kept != i) {
+            prepared_actions[kept] = prepared_actions[i];
+            prepared_info[kept] = prepared_info[i];
+            if (roi_item == i) {
+                roi_item = kept;
+            }
+        }
+        kept++;
+    }
+    if (kept == count) {
+        return;
+    }
+    prepared_actions.resize(kept);
+    prepared_info.resize(kept);
+
+    // Item hashes and the route id depend on seq.
+    vehicle.current_command_map.Reset();
+    for (size_t seq = 0; seq < kept; seq++) {
+        auto& mi = item(seq);
+        auto& info = prepared_info[seq];
+        mi->seq = seq;
+        Set_item_hashes(mi, info);
+        vehicle.current_command_map.Set_current_command(info.command_id);
+        vehicle.current_command_map.Accumulate_route_id(info.hash);
+        vehicle.current_command_map.Add_command_mapping(seq);
+    }
+    VEHICLE_LOG_INF(vehicle, "Mission compacted from %zu to %zu items.", count, kept);
+
+    std::unordered_set<int> kept_commands;
+    for (auto& info : prepared_info) {
+        kept_commands.insert(info.command_id);
+    }
+    std::vector<int> merged;
+    for (auto id : dropped_commands) {
+        if (!kept_commands.count(id)) {
+            merged.push_back(id);
+        }
+    }
+    if (merged.empty()) {
+        return;
+    }
+    std::sort(merged.begin(), merged.end());
+    merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+    VEHICLE_LOG_INF(vehicle, "Mission compacted, commands %s merged.",
+        Format_command_ranges(merged, std::string::npos).c_str());
+    vehicle.Add_status_message(
+        "Mission compacted, merged commands: " +
+        Format_command_ranges(merged, MERGED_COMMANDS_STATUS_MAX));
 }
 
 void
@@ -1551,7 +3324,7 @@ Px4_vehicle::Task_upload::Prepare_move(Action::Ptr& action)
     if (!camera_series_by_dist_active_in_wp) {
         if (camera_series_by_dist_active) {
             camera_series_by_dist_active = false;
-            mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+            mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
             (*mi)->command = mavlink::MAV_CMD::MAV_CMD_DO_SET_CAM_TRIGG_DIST;
             Add_mission_item(mi);
         }
@@ -1559,7 +3332,7 @@ Px4_vehicle::Task_upload::Prepare_move(Action::Ptr& action)
     if (!camera_series_by_time_active_in_wp) {
         if (camera_series_by_time_active) {
             camera_series_by_time_active = false;
-            mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+            mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
             if (px4_vehicle.camera_trigger_type == 1) {
                 (*mi)->command = mavlink::MAV_CMD::MAV_CMD_DO_REPEAT_SERVO;
                 (*mi)->param1 = px4_vehicle.camera_servo_idx;
@@ -1661,7 +3434,7 @@ void
 Px4_vehicle::Task_upload::Prepare_takeoff(Action::Ptr& action)
 {
     auto takeoff = action->Get_action<Action::Type::TAKEOFF>();
-    mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+    mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
     if (vehicle.Is_vehicle_type(proto::VEHICLE_TYPE_VTOL)) {
         (*mi)->command = mavlink::MAV_CMD::MAV_CMD_NAV_VTOL_TAKEOFF;
     } else {
@@ -1678,7 +3451,7 @@ Px4_vehicle::Task_upload::Prepare_landing(Action::Ptr& action)
 {
     auto land = action->Get_action<Action::Type::LANDING>();
 
-    mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+    mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
     if (vehicle.Is_vehicle_type(proto::VEHICLE_TYPE_VTOL)) {
         (*mi)->command = mavlink::MAV_CMD::MAV_CMD_NAV_VTOL_LAND;
     } else {
@@ -1697,7 +3470,7 @@ Px4_vehicle::Task_upload::Prepare_vtol_transition(Action::Ptr& action)
 {
     if (vehicle.Is_vehicle_type(proto::VEHICLE_TYPE_VTOL)) {
         auto a = action->Get_action<Action::Type::VTOL_TRANSITION>();
-        mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+        mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
         (*mi)->command = mavlink::MAV_CMD::MAV_CMD_DO_VTOL_TRANSITION;
         switch (a->mode) {
         case Vtol_transition_action::FIXED:
@@ -1723,7 +3496,7 @@ Px4_vehicle::Task_upload::Prepare_change_speed(Action::Ptr& action)
     }
     current_speed = la->speed;
 
-    mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+    mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
     (*mi)->command = mavlink::MAV_CMD::MAV_CMD_DO_CHANGE_SPEED;
     (*mi)->param1 = 1; /* Ground Speed */
     (*mi)->param2 = la->speed;
@@ -1743,7 +3516,7 @@ Px4_vehicle::Task_upload::Prepare_POI(Action::Ptr& action)
         first_mission_poi_set = true;
     } else {
         // Reset POI. Generate next WPs as heading from now on.
-        mi = mavlink::Pld_mission_item::Create();
+        mi = arena.Create<mavlink::Pld_mission_item>();
         (*mi)->command = mavlink::MAV_CMD::MAV_CMD_DO_SET_ROI_NONE;
         current_mission_poi.Disengage();
     }
@@ -1777,7 +3550,7 @@ Px4_vehicle::Task_upload::Prepare_camera_series_by_distance(Action::Ptr& action)
 {
     Camera_series_by_distance_action::Ptr a =
         action->Get_action<Action::Type::CAMERA_SERIES_BY_DISTANCE>();
-    mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+    mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
     (*mi)->command = mavlink::MAV_CMD::MAV_CMD_DO_SET_CAM_TRIGG_DIST;
     (*mi)->param1 = a->interval;
     Add_mission_item(mi);
@@ -1792,7 +3565,7 @@ Px4_vehicle::Task_upload::Prepare_camera_mode(mavlink::CAMERA_MODE mode)
     if (!current_camera_mode || new_camera_mode != *current_camera_mode) {
         // to set new mode: set mode and add wait for 3 seconds
         // (it takes time for camera to change mode sometimes)
-         mavlink::Pld_mission_item::Ptr mi_set_camera_mode = mavlink::Pld_mission_item::Create();
+         mavlink::Pld_mission_item::Ptr mi_set_camera_mode = arena.Create<mavlink::Pld_mission_item>();
         (*mi_set_camera_mode)->target_system = px4_vehicle.real_system_id;
         (*mi_set_camera_mode)->target_component = px4_vehicle.camera_component_id;
         (*mi_set_camera_mode)->command = mavlink::MAV_CMD::MAV_CMD_SET_CAMERA_MODE;
@@ -1813,7 +3586,7 @@ Px4_vehicle::Task_upload::Prepare_camera_trigger_impl(bool multiply_photos, floa
 {
     // if no camera is found - use DO_REPEAT_SERVO command
     if (px4_vehicle.camera_trigger_type == 1) {
-        mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+        mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
         (*mi)->command = mavlink::MAV_CMD::MAV_CMD_DO_REPEAT_SERVO;
         (*mi)->param1 = px4_vehicle.camera_servo_idx;
         (*mi)->param2 = px4_vehicle.camera_servo_pwm;
@@ -1823,7 +3596,7 @@ Px4_vehicle::Task_upload::Prepare_camera_trigger_impl(bool multiply_photos, floa
     } else {
         Prepare_camera_mode(mavlink::CAMERA_MODE::CAMERA_MODE_IMAGE);
 
-        mavlink::Pld_mission_item::Ptr mi_start_capture = mavlink::Pld_mission_item::Create();
+        mavlink::Pld_mission_item::Ptr mi_start_capture = arena.Create<mavlink::Pld_mission_item>();
         (*mi_start_capture)->target_system = px4_vehicle.real_system_id;
         (*mi_start_capture)->target_component = px4_vehicle.camera_component_id;
         (*mi_start_capture)->command = mavlink::MAV_CMD::MAV_CMD_IMAGE_START_CAPTURE;
@@ -1839,7 +3612,7 @@ Px4_vehicle::Task_upload::Prepare_camera_trigger_impl(bool multiply_photos, floa
 void Px4_vehicle::Task_upload::Prepare_camera_recording_impl(bool start_recording) {
     Prepare_camera_mode(mavlink::CAMERA_MODE::CAMERA_MODE_VIDEO);
 
-    mavlink::Pld_mission_item::Ptr mi_start_capture = mavlink::Pld_mission_item::Create();
+    mavlink::Pld_mission_item::Ptr mi_start_capture = arena.Create<mavlink::Pld_mission_item>();
     if (start_recording) {
         (*mi_start_capture)->command = mavlink::MAV_CMD::MAV_CMD_VIDEO_START_CAPTURE;
         (*mi_start_capture)->target_system = px4_vehicle.real_system_id;
@@ -1894,7 +3667,7 @@ Px4_vehicle::Task_upload::Prepare_camera_control(Action::Ptr& action)
     Camera_control_action::Ptr cam_control =
             action->Get_action<Action::Type::CAMERA_CONTROL>();
 
-    mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+    mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
     (*mi)->command = mavlink::MAV_CMD::MAV_CMD_DO_MOUNT_CONTROL;
 
     /** In action target camera tilt value is in radians: [-Pi/2, Pi/2], where -Pi/2 stands
@@ -1912,7 +3685,7 @@ Px4_vehicle::Task_upload::Prepare_camera_control(Action::Ptr& action)
 mavlink::Pld_mission_item::Ptr
 Px4_vehicle::Task_upload::Build_roi_mission_item(const Geodetic_tuple& coords)
 {
-    mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+    mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
     (*mi)->command = mavlink::MAV_CMD::MAV_CMD_DO_SET_ROI_LOCATION;
     Fill_mavlink_mission_item_coords(*mi, coords, 0);
     return mi;
@@ -1922,7 +3695,7 @@ mavlink::Pld_mission_item::Ptr
 Px4_vehicle::Task_upload::Build_wp_mission_item(Action::Ptr& action)
 {
     Move_action::Ptr ma = action->Get_action<Action::Type::MOVE>();
-    mavlink::Pld_mission_item::Ptr mi = mavlink::Pld_mission_item::Create();
+    mavlink::Pld_mission_item::Ptr mi = arena.Create<mavlink::Pld_mission_item>();
 
     (*mi)->command = mavlink::MAV_CMD::MAV_CMD_NAV_WAYPOINT;
     (*mi)->current = 0;
@@ -2032,13 +3805,39 @@ Px4_vehicle::Process_heartbeat(
     }
 
     Update_capability_states();
+
+    int control_mode = -1;
+    t_control_mode->Get_value(control_mode);
+    if (state.native_flight_mode != native_flight_mode.data ||
+        state.flight_mode != (current_flight_mode ? *current_flight_mode : -1) ||
+        state.control_mode != control_mode ||
+        state.is_armed != Is_armed()) {
+        state.native_flight_mode = native_flight_mode.data;
+        state.flight_mode = current_flight_mode ? *current_flight_mode : -1;
+        state.control_mode = control_mode;
+        state.is_armed = Is_armed();
+        Publish_state();
+    }
 }
 
 void
 Px4_vehicle::Update_capability_states()
 {
-    int current_control_mode;
+    int current_control_mode = -1;
     t_control_mode->Get_value(current_control_mode);
+
+    // Capabilities depend only on these, skip the update if none changed.
+    uint64_t state =
+        (static_cast<uint64_t>(native_flight_mode.data) << 32) |
+        ((current_control_mode & 0xff) << 16) |
+        ((current_flight_mode ? (*current_flight_mode + 1) & 0xff : 0) << 8) |
+        (Is_armed() << 1) |
+        is_airborne;
+    if (capability_state && *capability_state == state) {
+        return;
+    }
+    capability_state = state;
+
     c_direct_vehicle_control->Set_enabled(Is_control_mode(proto::CONTROL_MODE_JOYSTICK));
     c_direct_vehicle_control->Set_available(Is_control_mode(proto::CONTROL_MODE_JOYSTICK));
     c_manual->Set_enabled(current_control_mode != proto::CONTROL_MODE_MANUAL);
@@ -2068,7 +3867,28 @@ Px4_vehicle::Update_capability_states()
         c_takeoff_command->Set_enabled(Is_armed());
         c_arm->Set_enabled(!Is_armed() && current_control_mode != proto::CONTROL_MODE_AUTO);
     }
+    Schedule_commit();
+}
+
+void
+Px4_vehicle::Schedule_commit()
+{
+    if (ucs_commit_period.count() == 0) {
+        Commit_to_ucs();
+        return;
+    }
+    if (commit_timer.Is_armed()) {
+        // Commit already pending, it will carry this change too.
+        return;
+    }
+    Get_timer_wheel().Arm(commit_timer, ucs_commit_period);
+}
+
+bool
+Px4_vehicle::Commit_timer()
+{
     Commit_to_ucs();
+    return false;
 }
 
 void
@@ -2077,6 +3897,10 @@ Px4_vehicle::On_extended_sys_state(
 {
     is_airborne = (message->payload->landed_state == mavlink::MAV_LANDED_STATE_IN_AIR);
     Update_capability_states();
+    if (state.is_airborne != is_airborne) {
+        state.is_airborne = is_airborne;
+        Publish_state();
+    }
 }
 
 void
@@ -2161,6 +3985,114 @@ Px4_vehicle::Configure_real_vehicle()
         }
     }
 
+    if (props->Exists("vehicle.px4.ucs_commit_period")) {
+        auto period = props->Get_int("vehicle.px4.ucs_commit_period");
+        if (period < 0) {
+            period = 0;
+        } else if (period > 5000) {
+            period = 5000;
+        }
+        ucs_commit_period = std::chrono::milliseconds(period);
+        LOG_INFO("UCS commit period set to %d ms.", period);
+    }
+
+    if (props->Exists("vehicle.px4.joystick_rate")) {
+        auto rate = props->Get_int("vehicle.px4.joystick_rate");
+        if (rate < 1) {
+            rate = 1;
+        } else if (rate > 50) {
+            rate = 50;
+        }
+        direct_vehicle_control_period = std::chrono::milliseconds(1000 / rate);
+        LOG_INFO("Joystick rate set to %d Hz.", rate);
+    }
+
+    if (props->Exists("vehicle.px4.joystick_jitter_buffer")) {
+        auto delay = props->Get_int("vehicle.px4.joystick_jitter_buffer");
+        if (delay < 0) {
+            delay = 0;
+        } else if (delay > 500) {
+            delay = 500;
+        }
+        joystick_jitter_delay = std::chrono::milliseconds(delay);
+        LOG_INFO("Joystick jitter buffer set to %d ms.", delay);
+    }
+
+    if (props->Exists("vehicle.px4.gimbal_rate")) {
+        auto rate = props->Get_int("vehicle.px4.gimbal_rate");
+        if (rate <= 0) {
+            gimbal_period = std::chrono::milliseconds::zero();
+        } else {
+            if (rate > 50) {
+                rate = 50;
+            }
+            gimbal_period = std::chrono::milliseconds(1000 / rate);
+            LOG_INFO("Gimbal control streamed at %d Hz.", rate);
+        }
+    }
+
+    if (props->Exists("vehicle.px4.adaptive_telemetry")) {
+        auto yes = props->Get("vehicle.px4.adaptive_telemetry");
+        if (yes == "yes") {
+            adaptive_telemetry = true;
+            LOG_INFO("Adaptive telemetry rate enabled.");
+        } else if (yes == "no") {
+            adaptive_telemetry = false;
+        } else {
+            LOG_ERR("Invalid value '%s' for adaptive_telemetry", yes.c_str());
+        }
+    }
+
+    if (props->Exists("mavlink.vsm_system_id")) {
+        vsm_system_id = props->Get_int("mavlink.vsm_system_id");
+    }
+
+    if (props->Exists("vehicle.px4.mission_cache_path")) {
+        auto path = props->Get("vehicle.px4.mission_cache_path");
+        Trim(path);
+        if (path.size()) {
+            mission_cache_path = path;
+        }
+    }
+
+    if (props->Exists("vehicle.px4.mission_dump_format")) {
+        auto format = props->Get("vehicle.px4.mission_dump_format");
+        if (format == "text") {
+            mission_dump_formats = Mission_dump_writer::FORMAT_TEXT;
+        } else if (format == "binary") {
+            mission_dump_formats = Mission_dump_writer::FORMAT_BINARY;
+        } else if (format == "both") {
+            mission_dump_formats = Mission_dump_writer::FORMAT_TEXT | Mission_dump_writer::FORMAT_BINARY;
+        } else {
+            LOG_ERR("Invalid value '%s' for mission_dump_format", format.c_str());
+        }
+    }
+
+    if (props->Exists("vehicle.px4.mission_compaction")) {
+        auto yes = props->Get("vehicle.px4.mission_compaction");
+        if (yes == "yes") {
+            mission_compaction = true;
+            LOG_INFO("Mission compaction enabled.");
+        } else if (yes == "no") {
+            mission_compaction = false;
+        } else {
+            LOG_ERR("Invalid value '%s' for mission_compaction", yes.c_str());
+        }
+    }
+
+    if (props->Exists("vehicle.px4.route_simplification_tolerance")) {
+        auto tolerance = props->Get_float("vehicle.px4.route_simplification_tolerance");
+        if (tolerance < 0) {
+            tolerance = 0;
+        } else if (tolerance > ROUTE_SIMPLIFICATION_TOLERANCE_MAX) {
+            tolerance = ROUTE_SIMPLIFICATION_TOLERANCE_MAX;
+        }
+        route_simplification_tolerance = tolerance;
+        if (tolerance > 0) {
+            LOG_INFO("Route simplification tolerance set to %.2f m.", tolerance);
+        }
+    }
+
     telemetry_rates[mavlink::ALTITUDE] = DEFAULT_TELEMETRY_RATE;
     telemetry_rates[mavlink::ATTITUDE] = DEFAULT_TELEMETRY_RATE;
     telemetry_rates[mavlink::GLOBAL_POSITION_INT] = DEFAULT_TELEMETRY_RATE;
@@ -2204,15 +4136,29 @@ Px4_vehicle::Configure_real_vehicle()
         LOG("Setting telemetry_rate for %s to %0.2f Hz", it[3].c_str(), value);
     }
 
+    Update_expected_telemetry_rate();
+}
+
+void
+Px4_vehicle::Update_expected_telemetry_rate()
+{
+    auto rate = [this](int id) {
+        auto it = effective_telemetry_rates.find(id);
+        if (it != effective_telemetry_rates.end()) {
+            return it->second;
+        }
+        return Get_telemetry_rate(id);
+    };
+
     // We are counting 6 messages as telemetry:
     // SYS_STATUS, GLOBAL_POSITION_INT, ATTITUDE, VFR_HUD, GPS_RAW_INT, ALTITUDE
     expected_telemetry_rate =
-        telemetry_rates[mavlink::ALTITUDE] +
-        telemetry_rates[mavlink::ATTITUDE] +
-        telemetry_rates[mavlink::GLOBAL_POSITION_INT] +
-        telemetry_rates[mavlink::GPS_RAW_INT] +
-        telemetry_rates[mavlink::SYS_STATUS] +
-        telemetry_rates[mavlink::VFR_HUD];
+        rate(mavlink::ALTITUDE) +
+        rate(mavlink::ATTITUDE) +
+        rate(mavlink::GLOBAL_POSITION_INT) +
+        rate(mavlink::GPS_RAW_INT) +
+        rate(mavlink::SYS_STATUS) +
+        rate(mavlink::VFR_HUD);
 
     LOG("Setting expected telemetry_rate to %0.2f", expected_telemetry_rate);
 }
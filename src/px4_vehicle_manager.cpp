@@ -43,7 +43,7 @@ Px4_vehicle_manager::Create_mavlink_vehicle(
         ugcs::vsm::Request_processor::Ptr proc,
         ugcs::vsm::Request_completion_context::Ptr comp)
 {
-    return Px4_vehicle::Create(
+    auto vehicle = Px4_vehicle::Create(
             system_id,
             component_id,
             type,
@@ -53,10 +53,43 @@ Px4_vehicle_manager::Create_mavlink_vehicle(
             model_name,
             proc,
             comp);
+    vehicle->Set_timer_wheel(Get_timer_wheel(comp));
+    vehicle->Set_mission_dump_writer(Get_mission_dump_writer());
+    return vehicle;
+}
+
+Timer_wheel::Ptr
+Px4_vehicle_manager::Get_timer_wheel(ugcs::vsm::Request_completion_context::Ptr comp)
+{
+    // Forget wheels of contexts without vehicles.
+    for (auto iter = timer_wheels.begin(); iter != timer_wheels.end();) {
+        if (iter->second.expired()) {
+            iter = timer_wheels.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+    auto wheel = timer_wheels[comp].lock();
+    if (!wheel) {
+        wheel = Px4_vehicle::Create_timer_wheel(comp);
+        timer_wheels[comp] = wheel;
+    }
+    return wheel;
+}
+
+Mission_dump_writer::Ptr
+Px4_vehicle_manager::Get_mission_dump_writer()
+{
+    if (!mission_dump_writer) {
+        mission_dump_writer = std::make_shared<Mission_dump_writer>();
+    }
+    return mission_dump_writer;
 }
 
 void
 Px4_vehicle_manager::On_manager_disable()
 {
     copter_processor->Disable();
+    // Vehicles keep their references, the last one finishes the writes.
+    mission_dump_writer = nullptr;
 }
@@ -0,0 +1,60 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <rtt_estimator.h>
+#include <cmath>
+
+constexpr std::chrono::milliseconds Rtt_estimator::TIMEOUT_MIN;
+constexpr std::chrono::milliseconds Rtt_estimator::TIMEOUT_MAX;
+
+namespace {
+
+/** Gains from RFC 6298. */
+constexpr double ALPHA = 1.0 / 8;
+constexpr double BETA = 1.0 / 4;
+
+/** Variance multiplier of the timeout. */
+constexpr double K = 4;
+
+/** Doublings beyond this always hit TIMEOUT_MAX. */
+constexpr unsigned BACKOFF_MAX = 16;
+
+} /* anonymous namespace */
+
+void
+Rtt_estimator::Add_sample(std::chrono::steady_clock::duration rtt)
+{
+    double r = std::chrono::duration<double, std::milli>(rtt).count();
+    if (samples) {
+        rttvar = (1 - BETA) * rttvar + BETA * std::fabs(srtt - r);
+        srtt = (1 - ALPHA) * srtt + ALPHA * r;
+    } else {
+        srtt = r;
+        rttvar = r / 2;
+    }
+    samples++;
+    backoff = 0;
+}
+
+void
+Rtt_estimator::Backoff()
+{
+    if (backoff < BACKOFF_MAX) {
+        backoff++;
+    }
+}
+
+std::chrono::milliseconds
+Rtt_estimator::Get_timeout(std::chrono::milliseconds initial) const
+{
+    double timeout = samples ? srtt + K * rttvar : initial.count();
+    timeout *= 1 << backoff;
+    if (timeout < TIMEOUT_MIN.count()) {
+        return TIMEOUT_MIN;
+    }
+    if (timeout > TIMEOUT_MAX.count()) {
+        return TIMEOUT_MAX;
+    }
+    return std::chrono::milliseconds(static_cast<long>(std::ceil(timeout)));
+}
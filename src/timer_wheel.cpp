@@ -0,0 +1,172 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <timer_wheel.h>
+
+void
+Timer_wheel::Timer::Cancel()
+{
+    if (wheel) {
+        Unlink(*this);
+        wheel->armed_count--;
+        wheel = nullptr;
+    }
+}
+
+Timer_wheel::Timer_wheel(std::chrono::milliseconds tick):
+    tick(tick),
+    start_time(Clock::now())
+{
+}
+
+Timer_wheel::~Timer_wheel()
+{
+    for (auto& level : slots) {
+        for (auto& slot : level) {
+            while (slot.next != &slot) {
+                static_cast<Timer*>(slot.next)->Cancel();
+            }
+        }
+    }
+}
+
+void
+Timer_wheel::Set_wakeup_handler(Wakeup_handler handler)
+{
+    wakeup_handler = std::move(handler);
+}
+
+void
+Timer_wheel::Arm(Timer& timer, std::chrono::milliseconds interval)
+{
+    timer.Cancel();
+
+    auto now = Clock::now();
+    bool wakeup = false;
+    if (!ticking) {
+        // Idle wheel was not advanced, catch up without walking the slots.
+        auto ticks = Get_ticks(now);
+        if (ticks > current) {
+            current = ticks;
+        }
+        ticking = true;
+        wakeup = true;
+    }
+
+    // Round up, so the timer never fires earlier than requested.
+    auto offset = now + interval - start_time;
+    Schedule(timer, (offset + tick - Clock::duration(1)) / tick, interval);
+
+    if (wakeup && wakeup_handler) {
+        wakeup_handler();
+    }
+}
+
+bool
+Timer_wheel::Advance(Clock::time_point now)
+{
+    auto target = Get_ticks(now);
+    while (current < target && armed_count) {
+        current++;
+        Cascade();
+        Link expired;
+        Splice(slots[0][current & SLOT_MASK], expired);
+        // Handlers may arm and cancel any timers, including the expired
+        // ones still in the list.
+        while (expired.next != &expired) {
+            auto& timer = *static_cast<Timer*>(expired.next);
+            timer.Cancel();
+            if (timer.handler && timer.handler() && !timer.wheel) {
+                // Periodic timer, keep the period regardless of handler
+                // execution time.
+                Schedule(
+                    timer,
+                    current + (timer.interval + tick - std::chrono::milliseconds(1)) / tick,
+                    timer.interval);
+            }
+        }
+    }
+    if (current < target) {
+        current = target;
+    }
+    ticking = armed_count != 0;
+    return ticking;
+}
+
+void
+Timer_wheel::Schedule(Timer& timer, uint64_t expires, std::chrono::milliseconds interval)
+{
+    if (expires <= current) {
+        expires = current + 1;
+    } else if (expires - current > MAX_DELTA) {
+        expires = current + MAX_DELTA;
+    }
+    timer.expires = expires;
+    timer.interval = interval;
+    timer.wheel = this;
+    armed_count++;
+    Insert(timer);
+}
+
+uint64_t
+Timer_wheel::Get_ticks(Clock::time_point time) const
+{
+    return (time - start_time) / tick;
+}
+
+void
+Timer_wheel::Insert(Timer& timer)
+{
+    auto delta = timer.expires - current;
+    unsigned level = 0;
+    while (level < LEVELS - 1 && delta >= (uint64_t(1) << (LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    auto& slot = slots[level][(timer.expires >> (LEVEL_BITS * level)) & SLOT_MASK];
+    timer.prev = slot.prev;
+    timer.next = &slot;
+    slot.prev->next = &timer;
+    slot.prev = &timer;
+}
+
+void
+Timer_wheel::Cascade()
+{
+    for (unsigned level = 1; level < LEVELS; level++) {
+        if ((current >> (LEVEL_BITS * (level - 1))) & SLOT_MASK) {
+            // Lower level has not wrapped around.
+            return;
+        }
+        Link due;
+        Splice(slots[level][(current >> (LEVEL_BITS * level)) & SLOT_MASK], due);
+        while (due.next != &due) {
+            auto& timer = *static_cast<Timer*>(due.next);
+            Unlink(timer);
+            Insert(timer);
+        }
+    }
+}
+
+void
+Timer_wheel::Unlink(Link& link)
+{
+    link.prev->next = link.next;
+    link.next->prev = link.prev;
+    link.prev = &link;
+    link.next = &link;
+}
+
+void
+Timer_wheel::Splice(Link& from, Link& to)
+{
+    if (from.next == &from) {
+        return;
+    }
+    to.next = from.next;
+    to.prev = from.prev;
+    to.next->prev = &to;
+    to.prev->next = &to;
+    from.next = &from;
+    from.prev = &from;
+}
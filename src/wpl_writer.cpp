@@ -0,0 +1,104 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <wpl_writer.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+constexpr size_t Wpl_writer::LINE_MAX;
+constexpr size_t Wpl_writer::LINE_SIZE;
+
+namespace {
+
+constexpr int DECIMALS = 8;
+
+constexpr uint64_t DECIMALS_SCALE = 100000000;
+
+/** Larger values do not fit the fixed point conversion. */
+constexpr double FIXED_POINT_MAX = 1e10;
+
+/** Enough for any float with DECIMALS decimals. */
+constexpr size_t FLOAT_MAX = 64;
+
+const char HEADER[] = "QGC WPL 110";
+
+} /* anonymous namespace */
+
+Wpl_writer::Wpl_writer(std::string& out, bool crlf, size_t item_count):
+    out(out),
+    eol(crlf ? "\r\n" : "\n")
+{
+    out.reserve(out.size() + sizeof(HEADER) + 2 + item_count * LINE_SIZE);
+    out += HEADER;
+    out += eol;
+}
+
+void
+Wpl_writer::Write(const Wpl_item& item)
+{
+    char line[LINE_MAX];
+    char* pos = line;
+    pos = Format_int(pos, item.seq);
+    *pos++ = '\t';
+    pos = Format_int(pos, item.current);
+    *pos++ = '\t';
+    pos = Format_int(pos, item.frame);
+    *pos++ = '\t';
+    pos = Format_int(pos, item.command);
+    for (auto value : {item.param1, item.param2, item.param3, item.param4, item.x, item.y, item.z}) {
+        *pos++ = '\t';
+        pos = Format_float(pos, value);
+    }
+    *pos++ = '\t';
+    pos = Format_int(pos, item.autocontinue);
+    for (auto c = eol; *c; c++) {
+        *pos++ = *c;
+    }
+    out.append(line, pos - line);
+}
+
+char*
+Wpl_writer::Format_int(char* pos, int64_t value)
+{
+    uint64_t abs_value = value;
+    if (value < 0) {
+        *pos++ = '-';
+        abs_value = -static_cast<uint64_t>(value);
+    }
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = '0' + abs_value % 10;
+        abs_value /= 10;
+    } while (abs_value);
+    while (count) {
+        *pos++ = digits[--count];
+    }
+    return pos;
+}
+
+char*
+Wpl_writer::Format_float(char* pos, float value)
+{
+    if (!std::isfinite(value) || std::fabs(value) >= FIXED_POINT_MAX) {
+        // Rare, not worth a fast path.
+        return pos + snprintf(pos, FLOAT_MAX, "%.*f", DECIMALS, value);
+    }
+    if (std::signbit(value)) {
+        value = -value;
+        *pos++ = '-';
+    }
+    // Exact for float: 24 bit mantissa times 27 bit scale fits the double.
+    // Round half to even, like printf does.
+    auto scaled = static_cast<uint64_t>(std::nearbyint(static_cast<double>(value) * DECIMALS_SCALE));
+    pos = Format_int(pos, scaled / DECIMALS_SCALE);
+    *pos++ = '.';
+    auto fraction = scaled % DECIMALS_SCALE;
+    for (int i = DECIMALS - 1; i >= 0; i--) {
+        pos[i] = '0' + fraction % 10;
+        fraction /= 10;
+    }
+    return pos + DECIMALS;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <link.h>
+#include <algorithm>
+
+namespace px4_sim {
+
+Link::Link(const Link_faults& faults, uint32_t seed):
+    faults(faults),
+    seed(seed)
+{
+}
+
+bool
+Link::Chance(double probability, std::mt19937& random)
+{
+    return probability > 0 && std::uniform_real_distribution<double>(0, 1)(random) < probability;
+}
+
+void
+Link::Push(std::vector<uint8_t> datagram, uint32_t key, Clock::time_point now)
+{
+    auto iter = randoms.find(key);
+    if (iter == randoms.end()) {
+        std::seed_seq seeds {seed, key};
+        iter = randoms.emplace(key, std::mt19937(seeds)).first;
+    }
+    auto& random = iter->second;
+    if (Chance(faults.loss, random)) {
+        dropped++;
+        return;
+    }
+    auto sent = now;
+    if (faults.bandwidth) {
+        auto start = std::max(now, busy_until);
+        if (start - now > faults.queue_limit) {
+            dropped++;
+            return;
+        }
+        busy_until = start + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(datagram.size()) / faults.bandwidth));
+        sent = busy_until;
+    }
+    auto delivery = sent + faults.latency;
+    if (faults.jitter.count()) {
+        delivery += std::chrono::microseconds(std::uniform_int_distribution<long>(
+            0, std::chrono::duration_cast<std::chrono::microseconds>(faults.jitter).count())(random));
+    }
+    if (Chance(faults.reorder, random)) {
+        delivery += faults.reorder_delay;
+    }
+    queue.emplace(delivery, std::move(datagram));
+}
+
+void
+Link::Pop(Clock::time_point now, const Handler& handler)
+{
+    while (!queue.empty() && queue.begin()->first <= now) {
+        auto datagram = std::move(queue.begin()->second);
+        queue.erase(queue.begin());
+        handler(datagram);
+    }
+}
+
+} /* namespace px4_sim */
@@ -0,0 +1,101 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file link.h
+ *
+ * Emulation of a lossy telemetry link.
+ */
+#ifndef _PX4_SIM_LINK_H_
+#define _PX4_SIM_LINK_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace px4_sim {
+
+/** Faults of one link direction. */
+struct Link_faults {
+    /** Constant delay of each datagram. */
+    std::chrono::milliseconds latency {0};
+    /** Uniformly distributed extra delay, up to this value. */
+    std::chrono::milliseconds jitter {0};
+    /** Probability of a datagram loss, 0..1. */
+    double loss = 0;
+    /** Probability of a datagram to be held back, so that the following
+     * datagrams overtake it, 0..1. */
+    double reorder = 0;
+    /** Hold time of reordered datagrams. */
+    std::chrono::milliseconds reorder_delay {100};
+    /** Link capacity in bytes per second, 0 for unlimited. */
+    size_t bandwidth = 0;
+    /** Datagrams waiting longer than this for the bandwidth are dropped,
+     * as by a radio modem with a full buffer. */
+    std::chrono::milliseconds queue_limit {1000};
+
+    /** Link without faults, datagrams pass immediately. */
+    bool
+    Is_ideal() const
+    {
+        return latency.count() == 0 && jitter.count() == 0 && loss == 0 &&
+            reorder == 0 && bandwidth == 0;
+    }
+};
+
+/** One direction of a link. Delays and drops datagrams according to the
+ * faults. Datagrams are grouped by a key, e.g. message id, and each key
+ * draws faults from its own random sequence. So the fate of the n-th
+ * datagram of a key depends on the seed only, not on how other traffic
+ * was interleaved with it. Only drops by the bandwidth limit depend on
+ * timing.
+ */
+class Link {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    typedef std::function<void(const std::vector<uint8_t>&)> Handler;
+
+    Link(const Link_faults& faults, uint32_t seed);
+
+    /** Put datagram into the link. */
+    void
+    Push(std::vector<uint8_t> datagram, uint32_t key, Clock::time_point now);
+
+    /** Call handler for each datagram due at the given time. */
+    void
+    Pop(Clock::time_point now, const Handler& handler);
+
+    size_t
+    Get_dropped() const
+    {
+        return dropped;
+    }
+
+private:
+    static bool
+    Chance(double probability, std::mt19937& random);
+
+    Link_faults faults;
+
+    uint32_t seed;
+
+    /** Random sequences by datagram key. */
+    std::map<uint32_t, std::mt19937> randoms;
+
+    /** Datagrams by delivery time, equal times keep the push order. */
+    std::multimap<Clock::time_point, std::vector<uint8_t>> queue;
+
+    /** Bandwidth is used until this time. */
+    Clock::time_point busy_until;
+
+    size_t dropped = 0;
+};
+
+} /* namespace px4_sim */
+
+#endif /* _PX4_SIM_LINK_H_ */
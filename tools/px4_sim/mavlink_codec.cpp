@@ -0,0 +1,302 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <mavlink_codec.h>
+#include <algorithm>
+
+namespace px4_sim {
+
+namespace {
+
+constexpr uint8_t STX_V1 = 0xfe;
+constexpr uint8_t STX_V2 = 0xfd;
+constexpr size_t HEADER_V1 = 6;
+constexpr size_t HEADER_V2 = 10;
+constexpr size_t CHECKSUM = 2;
+constexpr uint8_t INCOMPAT_SIGNED = 0x01;
+constexpr size_t SIGNATURE = 13;
+
+struct Message_info {
+    uint32_t msgid;
+    uint8_t crc_extra;
+    uint8_t length;
+};
+
+/** CRC_EXTRA and full payload length with extensions, from common.xml. */
+const Message_info MESSAGES[] = {
+    {HEARTBEAT, 50, 9},
+    {SYS_STATUS, 124, 31},
+    {SYSTEM_TIME, 137, 12},
+    {PARAM_REQUEST_READ, 214, 20},
+    {PARAM_REQUEST_LIST, 159, 2},
+    {PARAM_VALUE, 220, 25},
+    {PARAM_SET, 168, 23},
+    {GPS_RAW_INT, 24, 30},
+    {ATTITUDE, 39, 28},
+    {GLOBAL_POSITION_INT, 104, 28},
+    {MISSION_WRITE_PARTIAL_LIST, 9, 7},
+    {MISSION_ITEM, 254, 38},
+    {MISSION_REQUEST, 230, 5},
+    {MISSION_SET_CURRENT, 28, 4},
+    {MISSION_CURRENT, 28, 2},
+    {MISSION_REQUEST_LIST, 132, 3},
+    {MISSION_COUNT, 221, 5},
+    {MISSION_CLEAR_ALL, 232, 3},
+    {MISSION_ITEM_REACHED, 11, 2},
+    {MISSION_ACK, 153, 4},
+    {MISSION_REQUEST_INT, 196, 5},
+    {MANUAL_CONTROL, 243, 11},
+    {MISSION_ITEM_INT, 38, 38},
+    {VFR_HUD, 20, 20},
+    {COMMAND_LONG, 152, 33},
+    {COMMAND_ACK, 143, 3},
+    {ALTITUDE, 47, 32},
+    {AUTOPILOT_VERSION, 178, 60},
+    {HOME_POSITION, 104, 52},
+    {MESSAGE_INTERVAL, 95, 6},
+    {EXTENDED_SYS_STATE, 130, 2},
+    {STATUSTEXT, 83, 51},
+};
+
+const Message_info*
+Find_message(uint32_t msgid)
+{
+    for (auto& info : MESSAGES) {
+        if (info.msgid == msgid) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+/** CRC-16/MCRF4XX as used by MAVLink. */
+void
+Crc_accumulate(uint16_t& crc, uint8_t byte)
+{
+    uint8_t tmp = byte ^ static_cast<uint8_t>(crc & 0xff);
+    tmp ^= static_cast<uint8_t>(tmp << 4);
+    crc = (crc >> 8) ^ (static_cast<uint16_t>(tmp) << 8) ^
+        (static_cast<uint16_t>(tmp) << 3) ^ (tmp >> 4);
+}
+
+uint16_t
+Crc(const uint8_t* data, size_t size, uint8_t crc_extra)
+{
+    uint16_t crc = 0xffff;
+    for (size_t i = 0; i < size; i++) {
+        Crc_accumulate(crc, data[i]);
+    }
+    Crc_accumulate(crc, crc_extra);
+    return crc;
+}
+
+} /* anonymous namespace */
+
+int
+Get_crc_extra(uint32_t msgid)
+{
+    auto info = Find_message(msgid);
+    return info ? info->crc_extra : -1;
+}
+
+size_t
+Get_payload_length(uint32_t msgid)
+{
+    auto info = Find_message(msgid);
+    return info ? info->length : 0;
+}
+
+std::vector<uint8_t>
+Encode(const Frame& frame)
+{
+    std::vector<uint8_t> out;
+    auto length = frame.payload.size();
+    if (frame.v2) {
+        while (length > 1 && frame.payload[length - 1] == 0) {
+            length--;
+        }
+        out.reserve(HEADER_V2 + length + CHECKSUM);
+        out.push_back(STX_V2);
+        out.push_back(static_cast<uint8_t>(length));
+        out.push_back(0);
+        out.push_back(0);
+        out.push_back(frame.seq);
+        out.push_back(frame.sysid);
+        out.push_back(frame.compid);
+        out.push_back(frame.msgid & 0xff);
+        out.push_back((frame.msgid >> 8) & 0xff);
+        out.push_back((frame.msgid >> 16) & 0xff);
+    } else {
+        out.reserve(HEADER_V1 + length + CHECKSUM);
+        out.push_back(STX_V1);
+        out.push_back(static_cast<uint8_t>(length));
+        out.push_back(frame.seq);
+        out.push_back(frame.sysid);
+        out.push_back(frame.compid);
+        out.push_back(static_cast<uint8_t>(frame.msgid));
+    }
+    out.insert(out.end(), frame.payload.begin(), frame.payload.begin() + length);
+    auto crc = Crc(out.data() + 1, out.size() - 1, Get_crc_extra(frame.msgid));
+    out.push_back(crc & 0xff);
+    out.push_back(crc >> 8);
+    return out;
+}
+
+uint32_t
+Peek_msgid(const uint8_t* data, size_t size)
+{
+    if (size >= HEADER_V2 && data[0] == STX_V2) {
+        return data[7] | (data[8] << 8) | (data[9] << 16);
+    }
+    if (size >= HEADER_V1 && data[0] == STX_V1) {
+        return data[5];
+    }
+    return UINT32_MAX;
+}
+
+void
+Decoder::Feed(const uint8_t* data, size_t size, const Handler& handler)
+{
+    buffer.insert(buffer.end(), data, data + size);
+    size_t pos = 0;
+    while (pos < buffer.size()) {
+        auto stx = buffer[pos];
+        if (stx != STX_V1 && stx != STX_V2) {
+            pos++;
+            continue;
+        }
+        bool v2 = stx == STX_V2;
+        size_t header = v2 ? HEADER_V2 : HEADER_V1;
+        if (buffer.size() - pos < header) {
+            break;
+        }
+        size_t length = buffer[pos + 1];
+        size_t total = header + length + CHECKSUM;
+        if (v2 && (buffer[pos + 2] & INCOMPAT_SIGNED)) {
+            total += SIGNATURE;
+        }
+        if (buffer.size() - pos < total) {
+            break;
+        }
+        Frame frame;
+        frame.v2 = v2;
+        if (v2) {
+            frame.seq = buffer[pos + 4];
+            frame.sysid = buffer[pos + 5];
+            frame.compid = buffer[pos + 6];
+            frame.msgid = buffer[pos + 7] | (buffer[pos + 8] << 8) | (buffer[pos + 9] << 16);
+        } else {
+            frame.seq = buffer[pos + 2];
+            frame.sysid = buffer[pos + 3];
+            frame.compid = buffer[pos + 4];
+            frame.msgid = buffer[pos + 5];
+        }
+        auto crc_extra = Get_crc_extra(frame.msgid);
+        if (crc_extra < 0) {
+            // Unknown message, can not be verified.
+            pos += total;
+            continue;
+        }
+        auto crc = Crc(&buffer[pos + 1], header - 1 + length, crc_extra);
+        auto crc_pos = pos + header + length;
+        if (buffer[crc_pos] != (crc & 0xff) || buffer[crc_pos + 1] != (crc >> 8)) {
+            // Could be a STX inside of garbage, resync on the next byte.
+            crc_errors++;
+            pos++;
+            continue;
+        }
+        auto begin = buffer.begin() + pos + header;
+        frame.payload.assign(begin, begin + length);
+        frame.payload.resize(std::max(length, Get_payload_length(frame.msgid)));
+        pos += total;
+        handler(frame);
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+}
+
+uint8_t
+Payload_reader::U8(size_t offset) const
+{
+    return offset < payload.size() ? payload[offset] : 0;
+}
+
+uint16_t
+Payload_reader::U16(size_t offset) const
+{
+    return U8(offset) | (U8(offset + 1) << 8);
+}
+
+uint32_t
+Payload_reader::U32(size_t offset) const
+{
+    return U16(offset) | (static_cast<uint32_t>(U16(offset + 2)) << 16);
+}
+
+uint64_t
+Payload_reader::U64(size_t offset) const
+{
+    return U32(offset) | (static_cast<uint64_t>(U32(offset + 4)) << 32);
+}
+
+float
+Payload_reader::Float(size_t offset) const
+{
+    auto bits = U32(offset);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+std::string
+Payload_reader::String(size_t offset, size_t size) const
+{
+    std::string value;
+    for (size_t i = 0; i < size; i++) {
+        auto c = U8(offset + i);
+        if (!c) {
+            break;
+        }
+        value.push_back(static_cast<char>(c));
+    }
+    return value;
+}
+
+void
+Payload_writer::U16(size_t offset, uint16_t value)
+{
+    U8(offset, value & 0xff);
+    U8(offset + 1, value >> 8);
+}
+
+void
+Payload_writer::U32(size_t offset, uint32_t value)
+{
+    U16(offset, value & 0xffff);
+    U16(offset + 2, value >> 16);
+}
+
+void
+Payload_writer::U64(size_t offset, uint64_t value)
+{
+    U32(offset, value & 0xffffffff);
+    U32(offset + 4, value >> 32);
+}
+
+void
+Payload_writer::Float(size_t offset, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    U32(offset, bits);
+}
+
+void
+Payload_writer::String(size_t offset, size_t size, const std::string& value)
+{
+    for (size_t i = 0; i < size; i++) {
+        U8(offset + i, i < value.size() ? value[i] : 0);
+    }
+}
+
+} /* namespace px4_sim */
@@ -0,0 +1,196 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file mavlink_codec.h
+ *
+ * Minimal MAVLink 1/2 framing for the PX4 simulator. Independent of the
+ * VSM SDK, so simulated vehicles do not share code paths with the VSM
+ * under test. Only messages the simulator uses are known.
+ */
+#ifndef _PX4_SIM_MAVLINK_CODEC_H_
+#define _PX4_SIM_MAVLINK_CODEC_H_
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace px4_sim {
+
+/** Ids of messages known to the simulator. */
+enum Message_id: uint32_t {
+    HEARTBEAT = 0,
+    SYS_STATUS = 1,
+    SYSTEM_TIME = 2,
+    PARAM_REQUEST_READ = 20,
+    PARAM_REQUEST_LIST = 21,
+    PARAM_VALUE = 22,
+    PARAM_SET = 23,
+    GPS_RAW_INT = 24,
+    ATTITUDE = 30,
+    GLOBAL_POSITION_INT = 33,
+    MISSION_WRITE_PARTIAL_LIST = 38,
+    MISSION_ITEM = 39,
+    MISSION_REQUEST = 40,
+    MISSION_SET_CURRENT = 41,
+    MISSION_CURRENT = 42,
+    MISSION_REQUEST_LIST = 43,
+    MISSION_COUNT = 44,
+    MISSION_CLEAR_ALL = 45,
+    MISSION_ITEM_REACHED = 46,
+    MISSION_ACK = 47,
+    MISSION_REQUEST_INT = 51,
+    MANUAL_CONTROL = 69,
+    MISSION_ITEM_INT = 73,
+    VFR_HUD = 74,
+    COMMAND_LONG = 76,
+    COMMAND_ACK = 77,
+    ALTITUDE = 141,
+    AUTOPILOT_VERSION = 148,
+    HOME_POSITION = 242,
+    MESSAGE_INTERVAL = 244,
+    EXTENDED_SYS_STATE = 245,
+    STATUSTEXT = 253,
+};
+
+/** Get CRC_EXTRA of a message, -1 if the message is unknown. */
+int
+Get_crc_extra(uint32_t msgid);
+
+/** Get full payload length of a message, 0 if the message is unknown. */
+size_t
+Get_payload_length(uint32_t msgid);
+
+/** MAVLink frame. */
+struct Frame {
+    uint32_t msgid = 0;
+    uint8_t sysid = 0;
+    uint8_t compid = 0;
+    uint8_t seq = 0;
+    /** MAVLink 2 framing. */
+    bool v2 = true;
+    /** Payload of full message length. */
+    std::vector<uint8_t> payload;
+};
+
+/** Encode the frame. MAVLink 2 payload trailing zeros are truncated. */
+std::vector<uint8_t>
+Encode(const Frame& frame);
+
+/** Get message id of the frame at the start of a datagram without
+ * verifying it. Returns UINT32_MAX if there is no frame header. */
+uint32_t
+Peek_msgid(const uint8_t* data, size_t size);
+
+/** Finds frames in the received bytes. Frames with bad checksum and
+ * unknown messages are skipped. */
+class Decoder {
+public:
+    typedef std::function<void(Frame&)> Handler;
+
+    /** Feed received bytes, handler is called for each decoded frame. */
+    void
+    Feed(const uint8_t* data, size_t size, const Handler& handler);
+
+    /** Number of frames dropped due to bad checksum. */
+    size_t
+    Get_crc_errors() const
+    {
+        return crc_errors;
+    }
+
+private:
+    std::vector<uint8_t> buffer;
+    size_t crc_errors = 0;
+};
+
+/** Little-endian field access at wire offsets of a payload. Reading past
+ * the end returns zeros, as MAVLink 2 truncated payloads require. */
+class Payload_reader {
+public:
+    explicit Payload_reader(const std::vector<uint8_t>& payload):
+        payload(payload) {}
+
+    uint8_t
+    U8(size_t offset) const;
+
+    uint16_t
+    U16(size_t offset) const;
+
+    int16_t
+    I16(size_t offset) const
+    {
+        return static_cast<int16_t>(U16(offset));
+    }
+
+    uint32_t
+    U32(size_t offset) const;
+
+    int32_t
+    I32(size_t offset) const
+    {
+        return static_cast<int32_t>(U32(offset));
+    }
+
+    uint64_t
+    U64(size_t offset) const;
+
+    float
+    Float(size_t offset) const;
+
+    /** Read zero padded char array. */
+    std::string
+    String(size_t offset, size_t size) const;
+
+private:
+    const std::vector<uint8_t>& payload;
+};
+
+/** Builds payload of a message. */
+class Payload_writer {
+public:
+    explicit Payload_writer(uint32_t msgid):
+        payload(Get_payload_length(msgid)) {}
+
+    void
+    U8(size_t offset, uint8_t value)
+    {
+        payload.at(offset) = value;
+    }
+
+    void
+    U16(size_t offset, uint16_t value);
+
+    void
+    I16(size_t offset, int16_t value)
+    {
+        U16(offset, static_cast<uint16_t>(value));
+    }
+
+    void
+    U32(size_t offset, uint32_t value);
+
+    void
+    I32(size_t offset, int32_t value)
+    {
+        U32(offset, static_cast<uint32_t>(value));
+    }
+
+    void
+    U64(size_t offset, uint64_t value);
+
+    void
+    Float(size_t offset, float value);
+
+    void
+    String(size_t offset, size_t size, const std::string& value);
+
+    std::vector<uint8_t> payload;
+};
+
+} /* namespace px4_sim */
+
+#endif /* _PX4_SIM_MAVLINK_CODEC_H_ */
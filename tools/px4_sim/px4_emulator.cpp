@@ -0,0 +1,178 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * PX4 emulator: simulated PX4 vehicles connecting to a VSM over UDP, with
+ * optional link faults. A stand-in for a real autopilot or PX4 SITL when
+ * testing the VSM. Runs until interrupted, printing counters of each
+ * vehicle periodically. See USAGE for options.
+ */
+
+#include <simulation.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace px4_sim;
+
+namespace {
+
+const char USAGE[] =
+    "Usage: px4_emulator [options]\n"
+    "  --vsm <address:port>     VSM connection.udp_in address, 127.0.0.1:14540\n"
+    "  --vehicles <n>           number of vehicles, 1\n"
+    "  --system-id <id>         system id of the first vehicle, 1\n"
+    "  --telemetry-rate <Hz>    default telemetry rate, 5\n"
+    "  --latency <ms>           one way link latency, 0\n"
+    "  --jitter <ms>            extra random delay up to this value, 0\n"
+    "  --loss <%>               datagram loss in each direction, 0\n"
+    "  --reorder <%>            datagrams held back and overtaken, 0\n"
+    "  --bandwidth <bytes/s>    link capacity in each direction, unlimited\n"
+    "  --seed <n>               random seed of the faults, 1\n"
+    "  --partial-write          accept MISSION_WRITE_PARTIAL_LIST\n"
+    "  --stats-period <s>       counters print period, 5\n";
+
+volatile sig_atomic_t terminate;
+
+void
+Sigint_handler(int)
+{
+    terminate = 1;
+}
+
+bool
+Parse_address(const std::string& value, sockaddr_in& address)
+{
+    auto colon = value.rfind(':');
+    auto host = value.substr(0, colon);
+    address = {};
+    address.sin_family = AF_INET;
+    if (colon != std::string::npos) {
+        address.sin_port = htons(std::atoi(value.c_str() + colon + 1));
+    }
+    return address.sin_port && inet_pton(AF_INET, host.c_str(), &address.sin_addr) == 1;
+}
+
+void
+Print_stats(size_t index, const Endpoint_config& config, const Px4_endpoint::Stats& stats)
+{
+    printf("vehicle %zu (sysid %d): sent %zu received %zu commands %zu retried %zu "
+           "uploads %zu last %.1f ms items %zu rerequests %zu unexpected %zu "
+           "downloads %zu dropped %zu\n",
+        index, config.system_id,
+        stats.frames_sent, stats.frames_received,
+        stats.commands_received, stats.commands_retried,
+        stats.mission_uploads, stats.last_upload_time.count() / 1000.0,
+        stats.mission_items_received, stats.mission_rerequests, stats.mission_items_unexpected,
+        stats.mission_downloads, stats.datagrams_dropped);
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+    sockaddr_in vsm_address;
+    Parse_address("127.0.0.1:14540", vsm_address);
+    size_t vehicles = 1;
+    int system_id = 1;
+    float telemetry_rate = 5;
+    Link_faults faults;
+    uint32_t seed = 1;
+    bool partial_write = false;
+    int stats_period = 5;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--help") {
+            fputs(USAGE, stdout);
+            return 0;
+        }
+        if (arg == "--partial-write") {
+            partial_write = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option %s\n%s", arg.c_str(), USAGE);
+            return 1;
+        }
+        const char* value = argv[++i];
+        if (arg == "--vsm") {
+            if (!Parse_address(value, vsm_address)) {
+                fprintf(stderr, "Invalid VSM address %s\n", value);
+                return 1;
+            }
+        } else if (arg == "--vehicles") {
+            vehicles = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--system-id") {
+            system_id = std::atoi(value);
+        } else if (arg == "--telemetry-rate") {
+            telemetry_rate = std::strtof(value, nullptr);
+        } else if (arg == "--latency") {
+            faults.latency = std::chrono::milliseconds(std::atoi(value));
+        } else if (arg == "--jitter") {
+            faults.jitter = std::chrono::milliseconds(std::atoi(value));
+        } else if (arg == "--loss") {
+            faults.loss = std::strtod(value, nullptr) / 100;
+        } else if (arg == "--reorder") {
+            faults.reorder = std::strtod(value, nullptr) / 100;
+        } else if (arg == "--bandwidth") {
+            faults.bandwidth = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--seed") {
+            seed = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--stats-period") {
+            stats_period = std::max(1, std::atoi(value));
+        } else {
+            fprintf(stderr, "Unknown option %s\n%s", arg.c_str(), USAGE);
+            return 1;
+        }
+    }
+    if (system_id < 1 || system_id + vehicles - 1 > 255) {
+        fprintf(stderr, "System ids must be in 1..255\n");
+        return 1;
+    }
+
+    Simulation sim;
+    std::vector<Endpoint_config> configs;
+    for (size_t i = 0; i < vehicles; i++) {
+        Endpoint_config config;
+        config.system_id = system_id + i;
+        config.uid = 0x5058340000000000 + config.system_id;
+        config.telemetry_rate = telemetry_rate;
+        config.partial_write = partial_write;
+        config.latitude += 0.001 * i;
+        std::unique_ptr<Px4_endpoint> endpoint(new Px4_endpoint(config, vsm_address));
+        // Each vehicle gets own fault sequence, the same on every run.
+        endpoint->Set_faults(faults, faults, seed + 2 * i);
+        sim.Add(std::move(endpoint));
+        configs.push_back(config);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = Sigint_handler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    sim.Start();
+    auto next_stats = std::chrono::steady_clock::now();
+    while (!terminate) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto now = std::chrono::steady_clock::now();
+        if (now < next_stats) {
+            continue;
+        }
+        next_stats = now + std::chrono::seconds(stats_period);
+        for (size_t i = 0; i < vehicles; i++) {
+            Print_stats(i, configs[i], sim.Get_stats(i));
+        }
+        fflush(stdout);
+    }
+    sim.Stop();
+    return 0;
+}
@@ -0,0 +1,793 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <px4_endpoint.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <iterator>
+#include <stdexcept>
+
+namespace px4_sim {
+
+namespace {
+
+constexpr uint8_t MAV_TYPE_QUADROTOR = 2;
+constexpr uint8_t MAV_AUTOPILOT_PX4 = 12;
+constexpr uint8_t MAV_MODE_FLAG_CUSTOM_MODE_ENABLED = 1;
+constexpr uint8_t MAV_MODE_FLAG_SAFETY_ARMED = 128;
+constexpr uint8_t MAV_STATE_STANDBY = 3;
+constexpr uint8_t MAV_STATE_ACTIVE = 4;
+
+constexpr uint8_t MAV_PARAM_TYPE_INT32 = 6;
+constexpr uint8_t MAV_PARAM_TYPE_REAL32 = 9;
+
+constexpr uint8_t MAV_RESULT_ACCEPTED = 0;
+
+constexpr uint16_t MAV_CMD_DO_SET_MODE = 176;
+constexpr uint16_t MAV_CMD_COMPONENT_ARM_DISARM = 400;
+constexpr uint16_t MAV_CMD_GET_MESSAGE_INTERVAL = 510;
+constexpr uint16_t MAV_CMD_SET_MESSAGE_INTERVAL = 511;
+constexpr uint16_t MAV_CMD_REQUEST_MESSAGE = 512;
+constexpr uint16_t MAV_CMD_REQUEST_AUTOPILOT_CAPABILITIES = 520;
+
+/** MISSION_FLOAT, PARAM_FLOAT, MISSION_INT, COMMAND_INT, MAVLINK2. */
+constexpr uint64_t CAPABILITIES = 1 | 2 | 4 | 8 | 8192;
+
+/** PX4 main mode AUTO, sub mode LOITER. */
+constexpr uint32_t MODE_AUTO_LOITER = (4 << 16) | (3 << 24);
+
+constexpr uint8_t MAV_MISSION_ACCEPTED = 0;
+constexpr uint8_t MAV_MISSION_ERROR = 1;
+constexpr uint8_t MAV_MISSION_NO_SPACE = 4;
+
+constexpr uint8_t MAV_FRAME_GLOBAL = 0;
+constexpr uint8_t MAV_FRAME_GLOBAL_RELATIVE_ALT = 3;
+constexpr uint8_t MAV_FRAME_GLOBAL_INT = 5;
+constexpr uint8_t MAV_FRAME_GLOBAL_RELATIVE_ALT_INT = 6;
+constexpr uint8_t MAV_FRAME_GLOBAL_TERRAIN_ALT = 10;
+constexpr uint8_t MAV_FRAME_GLOBAL_TERRAIN_ALT_INT = 11;
+
+/** Mission item request retry and transfer timeout, PX4 defaults. */
+constexpr std::chrono::milliseconds MISSION_RETRY_TIMEOUT {250};
+constexpr std::chrono::milliseconds MISSION_PROTOCOL_TIMEOUT {5000};
+
+/** PX4 dataman capacity of mission items. */
+constexpr size_t MISSION_ITEMS_MAX = 2000;
+
+/** Offsets of MISSION_ITEM and MISSION_ITEM_INT fields, the layouts
+ * differ only in the x and y types. */
+constexpr size_t ITEM_X = 16;
+constexpr size_t ITEM_Y = 20;
+constexpr size_t ITEM_SEQ = 28;
+constexpr size_t ITEM_TARGET_SYSTEM = 32;
+constexpr size_t ITEM_TARGET_COMPONENT = 33;
+constexpr size_t ITEM_FRAME = 34;
+constexpr size_t ITEM_MISSION_TYPE = 37;
+
+/** Rate of HOME_POSITION, PX4 default. */
+constexpr float HOME_POSITION_RATE = 0.5;
+
+constexpr float MISSION_CURRENT_RATE = 1;
+
+/** Datagrams are never longer than this on MAVLink links. */
+constexpr size_t DATAGRAM_MAX = 2048;
+
+uint32_t
+Float_bits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+Px4_endpoint::Clock::duration
+Rate_period(float rate)
+{
+    return std::chrono::duration_cast<Px4_endpoint::Clock::duration>(
+        std::chrono::duration<double>(1.0 / rate));
+}
+
+bool
+Is_global_frame(uint8_t frame)
+{
+    switch (frame) {
+    case MAV_FRAME_GLOBAL:
+    case MAV_FRAME_GLOBAL_RELATIVE_ALT:
+    case MAV_FRAME_GLOBAL_INT:
+    case MAV_FRAME_GLOBAL_RELATIVE_ALT_INT:
+    case MAV_FRAME_GLOBAL_TERRAIN_ALT:
+    case MAV_FRAME_GLOBAL_TERRAIN_ALT_INT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+} /* anonymous namespace */
+
+Px4_endpoint::Px4_endpoint(const Endpoint_config& config, const sockaddr_in& vsm_address):
+    config(config),
+    vsm_address(vsm_address),
+    boot_time(Clock::now()),
+    custom_mode(MODE_AUTO_LOITER)
+{
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        throw std::runtime_error("socket() failed");
+    }
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, reinterpret_cast<sockaddr*>(&local), sizeof(local)) < 0 ||
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) < 0) {
+        close(sock);
+        throw std::runtime_error("bind() failed");
+    }
+
+    parameters = {
+        {"SYS_AUTOSTART", {MAV_PARAM_TYPE_INT32, 4001}},
+        {"SYS_MC_EST_GROUP", {MAV_PARAM_TYPE_INT32, 2}},
+        {"GF_ACTION", {MAV_PARAM_TYPE_INT32, 1}},
+        {"NAV_RCL_ACT", {MAV_PARAM_TYPE_INT32, 2}},
+        {"COM_RC_IN_MODE", {MAV_PARAM_TYPE_INT32, 1}},
+        {"MIS_TAKEOFF_ALT", {MAV_PARAM_TYPE_REAL32, Float_bits(2.5)}},
+        {"MPC_XY_VEL_MAX", {MAV_PARAM_TYPE_REAL32, Float_bits(12)}},
+        {"MPC_XY_CRUISE", {MAV_PARAM_TYPE_REAL32, Float_bits(5)}},
+        {"MPC_Z_VEL_MAX_UP", {MAV_PARAM_TYPE_REAL32, Float_bits(3)}},
+        {"RTL_RETURN_ALT", {MAV_PARAM_TYPE_REAL32, Float_bits(60)}},
+    };
+
+    // Spread streams of different vehicles over the period, real vehicles
+    // are not synchronized either.
+    auto phase = std::chrono::milliseconds((config.system_id * 7919) % 1000);
+    auto start = boot_time + phase;
+    auto add = [&](uint32_t msgid, float rate) {
+        if (rate > 0) {
+            auto period = Rate_period(rate);
+            streams[msgid] = {period, period, start};
+        }
+    };
+    add(HEARTBEAT, config.heartbeat_rate);
+    for (auto msgid: {SYS_STATUS, GPS_RAW_INT, ATTITUDE, GLOBAL_POSITION_INT,
+                      VFR_HUD, ALTITUDE, EXTENDED_SYS_STATE}) {
+        add(msgid, config.telemetry_rate);
+    }
+    add(HOME_POSITION, HOME_POSITION_RATE);
+    add(MISSION_CURRENT, MISSION_CURRENT_RATE);
+    add(SYSTEM_TIME, config.probe_rate);
+}
+
+Px4_endpoint::~Px4_endpoint()
+{
+    close(sock);
+}
+
+uint64_t
+Px4_endpoint::Get_probe_time(Clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        time.time_since_epoch()).count();
+}
+
+void
+Px4_endpoint::Set_faults(const Link_faults& uplink, const Link_faults& downlink, uint32_t seed)
+{
+    if (!uplink.Is_ideal()) {
+        this->uplink.reset(new Link(uplink, seed));
+    }
+    if (!downlink.Is_ideal()) {
+        this->downlink.reset(new Link(downlink, seed + 1));
+    }
+}
+
+void
+Px4_endpoint::Receive(Clock::time_point now)
+{
+    this->now = now;
+    uint8_t buffer[DATAGRAM_MAX];
+    while (true) {
+        auto size = recv(sock, buffer, sizeof(buffer), 0);
+        if (size < 0) {
+            // EAGAIN or a pending ICMP error while VSM is not listening yet.
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (uplink) {
+            auto dropped = uplink->Get_dropped();
+            uplink->Push(std::vector<uint8_t>(buffer, buffer + size), Peek_msgid(buffer, size), now);
+            stats.datagrams_dropped += uplink->Get_dropped() - dropped;
+        } else {
+            Deliver(buffer, size);
+        }
+    }
+}
+
+void
+Px4_endpoint::Deliver(const uint8_t* data, size_t size)
+{
+    decoder.Feed(data, size, [this](Frame& frame) {
+        stats.frames_received++;
+        Handle(frame);
+    });
+}
+
+void
+Px4_endpoint::Tick(Clock::time_point now)
+{
+    this->now = now;
+    if (uplink) {
+        uplink->Pop(now, [this](const std::vector<uint8_t>& datagram) {
+            Deliver(datagram.data(), datagram.size());
+        });
+    }
+    for (auto& iter: streams) {
+        auto& stream = iter.second;
+        if (stream.next > now) {
+            continue;
+        }
+        Send_message(iter.first);
+        stream.next += stream.period;
+        if (stream.next <= now) {
+            // Do not burst after a stall.
+            stream.next = now + stream.period;
+        }
+    }
+    if (upload) {
+        if (now >= upload->deadline) {
+            // PX4 silently returns to idle.
+            upload.reset();
+        } else if (now >= upload->retry_at) {
+            stats.mission_rerequests++;
+            Request_item();
+        }
+    }
+    if (downlink) {
+        downlink->Pop(now, [this](const std::vector<uint8_t>& datagram) {
+            Send_datagram(datagram);
+        });
+    }
+}
+
+void
+Px4_endpoint::Send(Payload_writer& message, uint32_t msgid)
+{
+    Frame frame;
+    frame.msgid = msgid;
+    frame.sysid = config.system_id;
+    frame.compid = config.component_id;
+    frame.seq = seq++;
+    frame.payload = std::move(message.payload);
+    auto datagram = Encode(frame);
+    stats.frames_sent++;
+    stats.bytes_sent += datagram.size();
+    Transmit(std::move(datagram), msgid);
+}
+
+void
+Px4_endpoint::Transmit(std::vector<uint8_t> datagram, uint32_t msgid)
+{
+    if (downlink) {
+        auto dropped = downlink->Get_dropped();
+        downlink->Push(std::move(datagram), msgid, now);
+        stats.datagrams_dropped += downlink->Get_dropped() - dropped;
+    } else {
+        Send_datagram(datagram);
+    }
+}
+
+void
+Px4_endpoint::Send_datagram(const std::vector<uint8_t>& datagram)
+{
+    // Losses on a full socket buffer are a part of what is measured.
+    sendto(sock, datagram.data(), datagram.size(), 0,
+           reinterpret_cast<const sockaddr*>(&vsm_address), sizeof(vsm_address));
+}
+
+void
+Px4_endpoint::Handle(const Frame& frame)
+{
+    switch (frame.msgid) {
+    case COMMAND_LONG:
+        On_command_long(frame);
+        break;
+    case PARAM_REQUEST_READ:
+        On_param_request_read(frame);
+        break;
+    case PARAM_REQUEST_LIST:
+        if (Payload_reader(frame.payload).U8(0) == config.system_id) {
+            for (auto& param: parameters) {
+                Send_param_value(param.first);
+            }
+        }
+        break;
+    case PARAM_SET:
+        On_param_set(frame);
+        break;
+    case MISSION_COUNT:
+        On_mission_count(frame);
+        break;
+    case MISSION_WRITE_PARTIAL_LIST:
+        On_mission_write_partial_list(frame);
+        break;
+    case MISSION_ITEM:
+    case MISSION_ITEM_INT:
+        On_mission_item(frame);
+        break;
+    case MISSION_REQUEST:
+    case MISSION_REQUEST_INT:
+        On_mission_request(frame);
+        break;
+    case MISSION_REQUEST_LIST:
+        On_mission_request_list(frame);
+        break;
+    case MISSION_CLEAR_ALL:
+        On_mission_clear_all(frame);
+        break;
+    case MISSION_SET_CURRENT:
+        On_mission_set_current(frame);
+        break;
+    case MISSION_ACK:
+        // End of a download, nothing to do.
+        break;
+    }
+}
+
+void
+Px4_endpoint::On_command_long(const Frame& frame)
+{
+    Payload_reader cmd(frame.payload);
+    auto target = cmd.U8(30);
+    if (target != config.system_id && target != 0) {
+        return;
+    }
+    stats.commands_received++;
+    if (cmd.U8(32)) {
+        stats.commands_retried++;
+    }
+    auto command = cmd.U16(28);
+    uint8_t result = MAV_RESULT_ACCEPTED;
+    switch (command) {
+    case MAV_CMD_REQUEST_AUTOPILOT_CAPABILITIES:
+        Send_command_ack(command, result);
+        Send_autopilot_version();
+        return;
+    case MAV_CMD_REQUEST_MESSAGE:
+        Send_command_ack(command, result);
+        Send_message(static_cast<uint32_t>(cmd.Float(0)));
+        return;
+    case MAV_CMD_SET_MESSAGE_INTERVAL:
+        Set_interval(static_cast<uint32_t>(cmd.Float(0)), static_cast<int32_t>(cmd.Float(4)));
+        break;
+    case MAV_CMD_GET_MESSAGE_INTERVAL: {
+        auto msgid = static_cast<uint32_t>(cmd.Float(0));
+        Send_command_ack(command, result);
+        Payload_writer interval(MESSAGE_INTERVAL);
+        auto stream = streams.find(msgid);
+        interval.I32(0, stream == streams.end() ? -1 :
+            std::chrono::duration_cast<std::chrono::microseconds>(stream->second.period).count());
+        interval.U16(4, msgid);
+        Send(interval, MESSAGE_INTERVAL);
+        return;
+    }
+    case MAV_CMD_DO_SET_MODE:
+        custom_mode = (static_cast<uint32_t>(cmd.Float(4)) << 16) |
+                      (static_cast<uint32_t>(cmd.Float(8)) << 24);
+        break;
+    case MAV_CMD_COMPONENT_ARM_DISARM:
+        armed = cmd.Float(0) > 0.5;
+        break;
+    }
+    Send_command_ack(command, result);
+}
+
+void
+Px4_endpoint::Send_command_ack(uint16_t command, uint8_t result)
+{
+    Payload_writer ack(COMMAND_ACK);
+    ack.U16(0, command);
+    ack.U8(2, result);
+    Send(ack, COMMAND_ACK);
+}
+
+void
+Px4_endpoint::On_param_request_read(const Frame& frame)
+{
+    Payload_reader req(frame.payload);
+    if (req.U8(2) != config.system_id) {
+        return;
+    }
+    auto index = req.I16(0);
+    if (index >= 0) {
+        if (static_cast<size_t>(index) < parameters.size()) {
+            auto iter = parameters.begin();
+            std::advance(iter, index);
+            Send_param_value(iter->first);
+        }
+        return;
+    }
+    // PX4 does not answer requests of unknown parameters.
+    auto name = req.String(4, 16);
+    if (parameters.count(name)) {
+        Send_param_value(name);
+    }
+}
+
+void
+Px4_endpoint::On_param_set(const Frame& frame)
+{
+    Payload_reader req(frame.payload);
+    if (req.U8(4) != config.system_id) {
+        return;
+    }
+    auto name = req.String(6, 16);
+    auto param = parameters.find(name);
+    if (param == parameters.end()) {
+        return;
+    }
+    // Type mismatch is ignored as PX4 does, value is kept bitwise.
+    param->second.bits = req.U32(0);
+    Send_param_value(name);
+}
+
+void
+Px4_endpoint::Send_param_value(const std::string& name)
+{
+    auto param = parameters.find(name);
+    Payload_writer value(PARAM_VALUE);
+    value.U32(0, param->second.bits);
+    value.U16(4, parameters.size());
+    value.U16(6, std::distance(parameters.begin(), param));
+    value.String(8, 16, name);
+    value.U8(24, param->second.type);
+    Send(value, PARAM_VALUE);
+}
+
+void
+Px4_endpoint::On_mission_count(const Frame& frame)
+{
+    Payload_reader count(frame.payload);
+    if (count.U8(2) != config.system_id) {
+        return;
+    }
+    gcs_system_id = frame.sysid;
+    gcs_component_id = frame.compid;
+    auto mission_type = count.U8(4);
+    size_t items = count.U16(0);
+    if (items > MISSION_ITEMS_MAX) {
+        Send_mission_ack(MAV_MISSION_NO_SPACE, mission_type);
+        return;
+    }
+    if (!items) {
+        missions[mission_type].clear();
+        upload.reset();
+        Send_mission_ack(MAV_MISSION_ACCEPTED, mission_type);
+        return;
+    }
+    Start_upload(mission_type, 0, items - 1, true);
+}
+
+void
+Px4_endpoint::On_mission_write_partial_list(const Frame& frame)
+{
+    Payload_reader list(frame.payload);
+    if (list.U8(4) != config.system_id || !config.partial_write) {
+        return;
+    }
+    gcs_system_id = frame.sysid;
+    gcs_component_id = frame.compid;
+    auto mission_type = list.U8(6);
+    auto first = list.I16(0);
+    auto last = list.I16(2);
+    auto& mission = missions[mission_type];
+    if (first < 0 || last < first || static_cast<size_t>(last) >= mission.size()) {
+        Send_mission_ack(MAV_MISSION_ERROR, mission_type);
+        return;
+    }
+    Start_upload(mission_type, first, last, false);
+}
+
+void
+Px4_endpoint::Start_upload(uint8_t mission_type, size_t first, size_t last, bool full)
+{
+    upload.reset(new Upload);
+    upload->mission_type = mission_type;
+    upload->first = first;
+    upload->last = last;
+    upload->next = first;
+    upload->full = full;
+    // Whole transfer may happen within one Receive() on loopback.
+    upload->started = Clock::now();
+    Request_item();
+}
+
+void
+Px4_endpoint::Request_item()
+{
+    Payload_writer request(MISSION_REQUEST_INT);
+    request.U16(0, upload->next);
+    request.U8(2, gcs_system_id);
+    request.U8(3, gcs_component_id);
+    request.U8(4, upload->mission_type);
+    Send(request, MISSION_REQUEST_INT);
+    upload->retry_at = now + MISSION_RETRY_TIMEOUT;
+    upload->deadline = now + MISSION_PROTOCOL_TIMEOUT;
+}
+
+void
+Px4_endpoint::On_mission_item(const Frame& frame)
+{
+    Payload_reader item(frame.payload);
+    if (item.U8(ITEM_TARGET_SYSTEM) != config.system_id) {
+        return;
+    }
+    stats.mission_items_received++;
+    if (!upload || item.U8(ITEM_MISSION_TYPE) != upload->mission_type) {
+        stats.mission_items_unexpected++;
+        return;
+    }
+    if (item.U16(ITEM_SEQ) != upload->next) {
+        // Duplicate or a skipped item, ask for the expected one.
+        stats.mission_items_unexpected++;
+        Request_item();
+        return;
+    }
+    // Items are kept in MISSION_ITEM_INT form.
+    auto payload = frame.payload;
+    if (frame.msgid == MISSION_ITEM) {
+        Payload_writer converted(MISSION_ITEM_INT);
+        converted.payload = payload;
+        if (Is_global_frame(item.U8(ITEM_FRAME))) {
+            converted.I32(ITEM_X, std::lround(item.Float(ITEM_X) * 1e7));
+            converted.I32(ITEM_Y, std::lround(item.Float(ITEM_Y) * 1e7));
+        } else {
+            converted.I32(ITEM_X, std::lround(item.Float(ITEM_X)));
+            converted.I32(ITEM_Y, std::lround(item.Float(ITEM_Y)));
+        }
+        payload = std::move(converted.payload);
+    }
+    upload->items.push_back(std::move(payload));
+    if (upload->next < upload->last) {
+        upload->next++;
+        Request_item();
+        return;
+    }
+    auto& mission = missions[upload->mission_type];
+    if (upload->full) {
+        mission = std::move(upload->items);
+    } else {
+        std::move(upload->items.begin(), upload->items.end(), mission.begin() + upload->first);
+    }
+    stats.mission_uploads++;
+    stats.last_upload_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - upload->started);
+    auto mission_type = upload->mission_type;
+    upload.reset();
+    Send_mission_ack(MAV_MISSION_ACCEPTED, mission_type);
+}
+
+void
+Px4_endpoint::On_mission_request_list(const Frame& frame)
+{
+    Payload_reader list(frame.payload);
+    if (list.U8(0) != config.system_id) {
+        return;
+    }
+    gcs_system_id = frame.sysid;
+    gcs_component_id = frame.compid;
+    auto mission_type = list.U8(2);
+    Payload_writer count(MISSION_COUNT);
+    count.U16(0, missions[mission_type].size());
+    count.U8(2, frame.sysid);
+    count.U8(3, frame.compid);
+    count.U8(4, mission_type);
+    Send(count, MISSION_COUNT);
+    stats.mission_downloads++;
+}
+
+void
+Px4_endpoint::On_mission_request(const Frame& frame)
+{
+    Payload_reader request(frame.payload);
+    if (request.U8(2) != config.system_id) {
+        return;
+    }
+    auto mission_type = request.U8(4);
+    auto& mission = missions[mission_type];
+    auto index = request.U16(0);
+    if (index >= mission.size()) {
+        Send_mission_ack(MAV_MISSION_ERROR, mission_type);
+        return;
+    }
+    Payload_writer item(MISSION_ITEM_INT);
+    item.payload = mission[index];
+    Payload_reader stored(mission[index]);
+    item.U8(ITEM_TARGET_SYSTEM, frame.sysid);
+    item.U8(ITEM_TARGET_COMPONENT, frame.compid);
+    item.U8(35, index == mission_current);
+    if (frame.msgid == MISSION_REQUEST_INT) {
+        Send(item, MISSION_ITEM_INT);
+        return;
+    }
+    if (Is_global_frame(stored.U8(ITEM_FRAME))) {
+        item.Float(ITEM_X, stored.I32(ITEM_X) / 1e7);
+        item.Float(ITEM_Y, stored.I32(ITEM_Y) / 1e7);
+    } else {
+        item.Float(ITEM_X, stored.I32(ITEM_X));
+        item.Float(ITEM_Y, stored.I32(ITEM_Y));
+    }
+    Send(item, MISSION_ITEM);
+}
+
+void
+Px4_endpoint::On_mission_clear_all(const Frame& frame)
+{
+    Payload_reader clear(frame.payload);
+    if (clear.U8(0) != config.system_id) {
+        return;
+    }
+    gcs_system_id = frame.sysid;
+    gcs_component_id = frame.compid;
+    missions[clear.U8(2)].clear();
+    upload.reset();
+    mission_current = 0;
+    Send_mission_ack(MAV_MISSION_ACCEPTED, clear.U8(2));
+}
+
+void
+Px4_endpoint::On_mission_set_current(const Frame& frame)
+{
+    Payload_reader set(frame.payload);
+    if (set.U8(2) != config.system_id) {
+        return;
+    }
+    auto index = set.U16(0);
+    if (index < missions[0].size()) {
+        mission_current = index;
+    }
+    Send_message(MISSION_CURRENT);
+}
+
+void
+Px4_endpoint::Send_mission_ack(uint8_t type, uint8_t mission_type)
+{
+    Payload_writer ack(MISSION_ACK);
+    ack.U8(0, gcs_system_id);
+    ack.U8(1, gcs_component_id);
+    ack.U8(2, type);
+    ack.U8(3, mission_type);
+    Send(ack, MISSION_ACK);
+}
+
+void
+Px4_endpoint::Set_interval(uint32_t msgid, int32_t interval_us)
+{
+    auto stream = streams.find(msgid);
+    if (interval_us < 0) {
+        if (stream != streams.end()) {
+            streams.erase(stream);
+        }
+        return;
+    }
+    if (interval_us == 0) {
+        if (stream != streams.end()) {
+            stream->second.period = stream->second.default_period;
+        }
+        return;
+    }
+    auto period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::microseconds(interval_us));
+    if (stream == streams.end()) {
+        streams[msgid] = {period, period, now + period};
+    } else {
+        stream->second.period = period;
+        stream->second.next = std::min(stream->second.next, now + period);
+    }
+}
+
+void
+Px4_endpoint::Send_autopilot_version()
+{
+    Payload_writer version(AUTOPILOT_VERSION);
+    version.U64(0, CAPABILITIES);
+    version.U64(8, config.uid);
+    // Major, minor, patch and FIRMWARE_VERSION_TYPE_OFFICIAL.
+    version.U32(16, (config.version_major << 24) | (config.version_minor << 16) |
+                    (config.version_patch << 8) | 255);
+    Send(version, AUTOPILOT_VERSION);
+}
+
+void
+Px4_endpoint::Send_message(uint32_t msgid)
+{
+    auto since_boot = now - boot_time;
+    uint32_t boot_ms = std::chrono::duration_cast<std::chrono::milliseconds>(since_boot).count();
+    uint64_t boot_us = std::chrono::duration_cast<std::chrono::microseconds>(since_boot).count();
+    int32_t lat = std::lround(config.latitude * 1e7);
+    int32_t lon = std::lround(config.longitude * 1e7);
+    int32_t alt_mm = std::lround(config.altitude * 1000);
+
+    Payload_writer msg(msgid);
+    switch (msgid) {
+    case HEARTBEAT:
+        msg.U32(0, custom_mode);
+        msg.U8(4, MAV_TYPE_QUADROTOR);
+        msg.U8(5, MAV_AUTOPILOT_PX4);
+        msg.U8(6, MAV_MODE_FLAG_CUSTOM_MODE_ENABLED | (armed ? MAV_MODE_FLAG_SAFETY_ARMED : 0));
+        msg.U8(7, armed ? MAV_STATE_ACTIVE : MAV_STATE_STANDBY);
+        msg.U8(8, 3);
+        break;
+    case SYS_STATUS:
+        msg.U16(12, 250);
+        msg.U16(14, 16200);
+        msg.I16(16, 1200);
+        msg.U8(30, 87);
+        break;
+    case SYSTEM_TIME:
+        // Probe: steady clock of the sender, VSM handler computes latency.
+        msg.U64(0, Get_probe_time(now));
+        msg.U32(8, boot_ms);
+        stats.probes_sent++;
+        break;
+    case GPS_RAW_INT:
+        msg.U64(0, boot_us);
+        msg.I32(8, lat);
+        msg.I32(12, lon);
+        msg.I32(16, alt_mm);
+        msg.U16(20, 80);
+        msg.U16(22, 120);
+        msg.U8(28, 3);
+        msg.U8(29, 14);
+        break;
+    case ATTITUDE:
+        msg.U32(0, boot_ms);
+        msg.Float(12, 1.57);
+        break;
+    case GLOBAL_POSITION_INT:
+        msg.U32(0, boot_ms);
+        msg.I32(4, lat);
+        msg.I32(8, lon);
+        msg.I32(12, alt_mm);
+        msg.U16(26, 9000);
+        break;
+    case VFR_HUD:
+        msg.Float(8, config.altitude);
+        msg.I16(16, 90);
+        break;
+    case ALTITUDE:
+        msg.U64(0, boot_us);
+        msg.Float(8, config.altitude);
+        msg.Float(12, config.altitude);
+        break;
+    case EXTENDED_SYS_STATE:
+        msg.U8(1, armed ? 2 : 1);
+        break;
+    case MISSION_CURRENT:
+        msg.U16(0, mission_current);
+        break;
+    case HOME_POSITION:
+        msg.I32(0, lat);
+        msg.I32(4, lon);
+        msg.I32(8, alt_mm);
+        msg.Float(24, 1);
+        break;
+    case AUTOPILOT_VERSION:
+        Send_autopilot_version();
+        return;
+    default:
+        // Unknown message can not be sent.
+        if (msg.payload.empty()) {
+            return;
+        }
+    }
+    Send(msg, msgid);
+}
+
+} /* namespace px4_sim */
@@ -0,0 +1,273 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file px4_endpoint.h
+ *
+ * Simulated PX4 vehicle talking MAVLink over UDP.
+ */
+#ifndef _PX4_SIM_PX4_ENDPOINT_H_
+#define _PX4_SIM_PX4_ENDPOINT_H_
+
+#include <mavlink_codec.h>
+#include <link.h>
+#include <netinet/in.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace px4_sim {
+
+/** Configuration of a simulated vehicle. */
+struct Endpoint_config {
+    uint8_t system_id = 1;
+    uint8_t component_id = 1;
+    /** Hardware uid reported in AUTOPILOT_VERSION. */
+    uint64_t uid = 1;
+    /** Reported firmware version. */
+    uint8_t version_major = 1;
+    uint8_t version_minor = 11;
+    uint8_t version_patch = 0;
+    float heartbeat_rate = 1;
+    /** Default rate of each telemetry message, Hz. */
+    float telemetry_rate = 5;
+    /** Rate of SYSTEM_TIME latency probes, Hz. 0 disables probes. */
+    float probe_rate = 0;
+    /** Vehicle position, degrees and meters AMSL. */
+    double latitude = 56.95;
+    double longitude = 24.1;
+    float altitude = 30;
+    /** Accept MISSION_WRITE_PARTIAL_LIST. PX4 ignores it. */
+    bool partial_write = false;
+};
+
+/** Simulated PX4 vehicle. Sends heartbeats and telemetry, answers
+ * AUTOPILOT_VERSION, parameter, message interval and COMMAND_LONG
+ * requests and implements the mission protocol. Link faults can be
+ * injected in both directions. Not thread safe, driven by a single thread.
+ */
+class Px4_endpoint {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /** Counters of the endpoint. */
+    struct Stats {
+        size_t frames_sent = 0;
+        size_t bytes_sent = 0;
+        size_t frames_received = 0;
+        size_t probes_sent = 0;
+        size_t commands_received = 0;
+        /** COMMAND_LONG with nonzero confirmation, i.e. retries. */
+        size_t commands_retried = 0;
+        size_t mission_uploads = 0;
+        size_t mission_items_received = 0;
+        /** Item requests repeated after a timeout. */
+        size_t mission_rerequests = 0;
+        /** Items received not in sequence. */
+        size_t mission_items_unexpected = 0;
+        /** Duration of the last completed upload, from MISSION_COUNT or
+         * MISSION_WRITE_PARTIAL_LIST to the final MISSION_ACK. */
+        std::chrono::microseconds last_upload_time {0};
+        size_t mission_downloads = 0;
+        /** Datagrams dropped by the injected faults, both directions. */
+        size_t datagrams_dropped = 0;
+    };
+
+    /** Create endpoint with own UDP socket sending to VSM address. */
+    Px4_endpoint(const Endpoint_config& config, const sockaddr_in& vsm_address);
+
+    virtual
+    ~Px4_endpoint();
+
+    Px4_endpoint(const Px4_endpoint&) = delete;
+
+    Px4_endpoint&
+    operator=(const Px4_endpoint&) = delete;
+
+    int
+    Get_socket() const
+    {
+        return sock;
+    }
+
+    /** Inject faults into the link. Uplink is the direction to the vehicle.
+     * Should be called before any traffic. */
+    void
+    Set_faults(const Link_faults& uplink, const Link_faults& downlink, uint32_t seed);
+
+    /** Read and handle all pending datagrams. */
+    void
+    Receive(Clock::time_point now);
+
+    /** Send periodic messages and datagrams delayed by the link due at
+     * the given time, retry mission item requests. */
+    virtual void
+    Tick(Clock::time_point now);
+
+    const Stats&
+    Get_stats() const
+    {
+        return stats;
+    }
+
+    const Endpoint_config&
+    Get_config() const
+    {
+        return config;
+    }
+
+    /** Microseconds of the steady clock, used as probe timestamps. */
+    static uint64_t
+    Get_probe_time(Clock::time_point time);
+
+protected:
+    /** Encode and transmit message from this vehicle. */
+    void
+    Send(Payload_writer& message, uint32_t msgid);
+
+    /** Handle frame addressed to this vehicle. */
+    virtual void
+    Handle(const Frame& frame);
+
+    void
+    Send_command_ack(uint16_t command, uint8_t result);
+
+    Endpoint_config config;
+
+    Stats stats;
+
+    /** Time of the current Receive or Tick. */
+    Clock::time_point now;
+
+private:
+    /** Parameter value as PX4 keeps it, int values are stored bitwise. */
+    struct Parameter {
+        uint8_t type;
+        uint32_t bits;
+    };
+
+    /** Periodically sent message. */
+    struct Stream {
+        Clock::duration period;
+        Clock::duration default_period;
+        Clock::time_point next;
+    };
+
+    /** Mission transfer from VSM in progress. */
+    struct Upload {
+        uint8_t mission_type = 0;
+        /** Items first..last are written. */
+        size_t first = 0;
+        size_t last = 0;
+        size_t next = 0;
+        /** Whole mission is replaced. */
+        bool full = true;
+        std::vector<std::vector<uint8_t>> items;
+        Clock::time_point started;
+        Clock::time_point retry_at;
+        Clock::time_point deadline;
+    };
+
+    /** Put datagram on the wire or into the faulty link. */
+    void
+    Transmit(std::vector<uint8_t> datagram, uint32_t msgid);
+
+    /** Handle datagram received from VSM or from the faulty link. */
+    void
+    Deliver(const uint8_t* data, size_t size);
+
+    /** Send UDP datagram now. */
+    void
+    Send_datagram(const std::vector<uint8_t>& datagram);
+
+    void
+    On_command_long(const Frame& frame);
+
+    void
+    On_param_request_read(const Frame& frame);
+
+    void
+    On_param_set(const Frame& frame);
+
+    void
+    On_mission_count(const Frame& frame);
+
+    void
+    On_mission_write_partial_list(const Frame& frame);
+
+    void
+    On_mission_item(const Frame& frame);
+
+    void
+    On_mission_request(const Frame& frame);
+
+    void
+    On_mission_request_list(const Frame& frame);
+
+    void
+    On_mission_clear_all(const Frame& frame);
+
+    void
+    On_mission_set_current(const Frame& frame);
+
+    void
+    Start_upload(uint8_t mission_type, size_t first, size_t last, bool full);
+
+    void
+    Request_item();
+
+    void
+    Send_mission_ack(uint8_t type, uint8_t mission_type);
+
+    void
+    Send_param_value(const std::string& name);
+
+    void
+    Send_message(uint32_t msgid);
+
+    void
+    Send_autopilot_version();
+
+    void
+    Set_interval(uint32_t msgid, int32_t interval_us);
+
+    int sock = -1;
+
+    sockaddr_in vsm_address;
+
+    Decoder decoder;
+
+    uint8_t seq = 0;
+
+    Clock::time_point boot_time;
+
+    std::map<std::string, Parameter> parameters;
+
+    std::map<uint32_t, Stream> streams;
+
+    /** Items of missions by mission type, as MISSION_ITEM_INT payloads. */
+    std::map<uint8_t, std::vector<std::vector<uint8_t>>> missions;
+
+    std::unique_ptr<Upload> upload;
+
+    /** System and component of the mission transfer peer. */
+    uint8_t gcs_system_id = 0;
+    uint8_t gcs_component_id = 0;
+
+    uint16_t mission_current = 0;
+
+    std::unique_ptr<Link> uplink;
+
+    std::unique_ptr<Link> downlink;
+
+    /** PX4 custom mode: main mode in byte 2, sub mode in byte 3. */
+    uint32_t custom_mode;
+
+    bool armed = false;
+};
+
+} /* namespace px4_sim */
+
+#endif /* _PX4_SIM_PX4_ENDPOINT_H_ */
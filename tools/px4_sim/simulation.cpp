@@ -0,0 +1,109 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+#include <simulation.h>
+#include <poll.h>
+#include <time.h>
+#include <algorithm>
+
+namespace px4_sim {
+
+constexpr std::chrono::milliseconds Simulation::POLL_PERIOD;
+
+Simulation::~Simulation()
+{
+    Stop();
+}
+
+void
+Simulation::Add(std::unique_ptr<Px4_endpoint> endpoint)
+{
+    endpoints.push_back(std::move(endpoint));
+}
+
+void
+Simulation::Clear()
+{
+    Stop();
+    endpoints.clear();
+}
+
+void
+Simulation::Start()
+{
+    Stop();
+    stop = false;
+    cpu_time = 0;
+    thread = std::thread(&Simulation::Run, this);
+}
+
+void
+Simulation::Stop()
+{
+    if (thread.joinable()) {
+        stop = true;
+        thread.join();
+    }
+}
+
+Px4_endpoint::Stats
+Simulation::Get_stats()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    Px4_endpoint::Stats total;
+    for (auto& endpoint: endpoints) {
+        auto& stats = endpoint->Get_stats();
+        total.frames_sent += stats.frames_sent;
+        total.bytes_sent += stats.bytes_sent;
+        total.frames_received += stats.frames_received;
+        total.probes_sent += stats.probes_sent;
+        total.commands_received += stats.commands_received;
+        total.commands_retried += stats.commands_retried;
+        total.mission_uploads += stats.mission_uploads;
+        total.mission_items_received += stats.mission_items_received;
+        total.mission_rerequests += stats.mission_rerequests;
+        total.mission_items_unexpected += stats.mission_items_unexpected;
+        total.last_upload_time = std::max(total.last_upload_time, stats.last_upload_time);
+        total.mission_downloads += stats.mission_downloads;
+        total.datagrams_dropped += stats.datagrams_dropped;
+    }
+    return total;
+}
+
+Px4_endpoint::Stats
+Simulation::Get_stats(size_t index)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return endpoints.at(index)->Get_stats();
+}
+
+void
+Simulation::Run()
+{
+    std::vector<pollfd> fds(endpoints.size());
+    for (size_t i = 0; i < endpoints.size(); i++) {
+        fds[i].fd = endpoints[i]->Get_socket();
+        fds[i].events = POLLIN;
+    }
+    timespec start;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    while (!stop) {
+        poll(fds.data(), fds.size(), POLL_PERIOD.count());
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto now = Px4_endpoint::Clock::now();
+            for (size_t i = 0; i < endpoints.size(); i++) {
+                if (fds[i].revents) {
+                    endpoints[i]->Receive(now);
+                }
+                endpoints[i]->Tick(now);
+            }
+        }
+        timespec cpu;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        cpu_time = (cpu.tv_sec - start.tv_sec) * 1000000000LL + (cpu.tv_nsec - start.tv_nsec);
+    }
+}
+
+} /* namespace px4_sim */
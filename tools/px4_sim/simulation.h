@@ -0,0 +1,83 @@
+// Copyright (c) 2018, Smart Projects Holdings Ltd
+// All rights reserved.
+// See LICENSE file for license details.
+
+/**
+ * @file simulation.h
+ *
+ * Runs a set of simulated vehicles in a dedicated thread.
+ */
+#ifndef _PX4_SIM_SIMULATION_H_
+#define _PX4_SIM_SIMULATION_H_
+
+#include <px4_endpoint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace px4_sim {
+
+/** Drives endpoints from one thread: polls their sockets and sends
+ * periodic messages. Endpoints can be added only while stopped.
+ */
+class Simulation {
+public:
+    /** Resolution of periodic messages. */
+    constexpr static std::chrono::milliseconds POLL_PERIOD {2};
+
+    ~Simulation();
+
+    void
+    Add(std::unique_ptr<Px4_endpoint> endpoint);
+
+    /** Remove all endpoints, closing their sockets. */
+    void
+    Clear();
+
+    void
+    Start();
+
+    void
+    Stop();
+
+    size_t
+    Get_count() const
+    {
+        return endpoints.size();
+    }
+
+    /** Sum of counters of all endpoints. */
+    Px4_endpoint::Stats
+    Get_stats();
+
+    /** Counters of one endpoint. */
+    Px4_endpoint::Stats
+    Get_stats(size_t index);
+
+    /** CPU time consumed by the simulation thread since Start. */
+    std::chrono::nanoseconds
+    Get_cpu_time() const
+    {
+        return std::chrono::nanoseconds(cpu_time.load());
+    }
+
+private:
+    void
+    Run();
+
+    std::vector<std::unique_ptr<Px4_endpoint>> endpoints;
+
+    std::thread thread;
+
+    std::atomic<bool> stop {false};
+
+    std::atomic<int64_t> cpu_time {0};
+
+    /** Held by the thread while it works with endpoints. */
+    std::mutex mutex;
+};
+
+} /* namespace px4_sim */
+
+#endif /* _PX4_SIM_SIMULATION_H_ */